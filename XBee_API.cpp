@@ -60,7 +60,19 @@
 
 #include "XBee_API.h"
 
-#define XBEE_API_DEBUG
+//record the events in the trace (see XBeeTrace)
+#ifdef XBEE_API_DEBUG
+#define XBEE_TRACE(event, arg0, arg1, arg2) XBeeTrace::Record((event), (arg0), (arg1), (arg2))
+#else
+#define XBEE_TRACE(event, arg0, arg1, arg2) ((void)0)
+#endif
+
+//count in the statistics (see XBeeStats)
+#ifdef XBEE_API_STATS
+#define XBEE_STATS_ADD(counter) _stats.counter++
+#else
+#define XBEE_STATS_ADD(counter) ((void)0)
+#endif
 
 //user defined constants
 #define BAUDRATE_PC 9600
@@ -68,10 +80,83 @@
 
 //other constants
 #define AT_TIMEOUT 11000
+#define NEGOTIATE_TIMEOUT 200 //for each request of the negotiation
+#define NEGOTIATE_TRIES 2 //of the round trip check
+#define DETECT_TIMEOUT 100 //for each API probe of the detection
+#define GUARD_TIME 1000 //default value of GT
+#define GUARD_TIME_MARGIN 200 //to wait for the 'OK' after the guard time
+#define FRAGMENT_INTERVAL 5 //between the fragments sent
+#define FRAGMENT_TIMEOUT 500 //to wait for the ACK (or NACK) after the last fragment
+#define FRAGMENT_TRIES 4 //of the last fragment without response
+#define SCAN_TIMEOUT 8000 //of the energy and active scans (about 250 ms for each channel with the default SD)
+#define SCAN_PAN_PENALTY 10 //dB for each PAN found in the channel
+#define PACING_TIMEOUT 200 //maximum wait to send a frame
+#define PACING_EXPIRE LISTEN_TIMEOUT //to consider the response of a sent frame lost
+#define PACING_DRAIN 64 //initial microseconds per byte (250 kbps of the RF with overhead)
+#define LINK_TIMEOUT_MIN 100 //of the requests to a node with a known round trip time
+#define LINK_TIMEOUT_MAX 4000
+#define LINK_BACKOFF_MAX 3 //doublings of the timeout after consecutive requests without response
+#define LINK_TUNE_SENT 8 //requests without ACK failures to lower the retries (RR)
+#define LINK_RETRIES_MAX 6 //maximum value of RR
+#define QUEUE_STARVATION 4 //frames of the higher priorities sent before a waiting frame of a lower one
+#define RETRY_ATTEMPTS 3 //default maximum of attempts of the requests (with XBEE_USE_RETRIES)
+#define RETRY_BACKOFF 50 //default delay before the first retransmission (milliseconds)
+#define RETRY_BACKOFF_MAX 1000 //default maximum delay between the retransmissions
+#define STATIC_FRAME_SIZE 20 //biggest static frame copied to the RAM (with XBEE_USE_PACING or XBEE_API_CAPTURE)
+#define PROFILE_INVALID 31 //result of SetProfile()
+#define CTS_CHUNK 16 //bytes written while CTS is asserted (CTS is deasserted with 17 bytes left in the buffer of the XBee)
+#ifdef USE_SOFTWARE_SERIAL
+#define SERIAL_TX_BUFFER 0 //bytes still being sent when write() returns (the SoftwareSerial writes at once)
+#else
+#define SERIAL_TX_BUFFER 64 //bytes still being sent when write() returns (TX buffer of the HardwareSerial)
+#endif
 
 #define EMPTY_CHAR '#'
 #define CONTROL_CHAR '#'
 
+//jobs
+#define XBEE_JOB_NONE 0
+#define XBEE_JOB_CONFIGURE 1
+#define XBEE_JOB_PINS 2
+#define XBEE_JOB_RESTORE 3
+
+//steps of the jobs
+#define XBEE_STEP_ENTER 0
+#define XBEE_STEP_ID 1
+#define XBEE_STEP_CH 2
+#define XBEE_STEP_MY 3
+#define XBEE_STEP_BD 4
+#define XBEE_STEP_AP 5
+#define XBEE_STEP_PIN 6
+#define XBEE_STEP_RE 7
+#define XBEE_STEP_WR 8
+#define XBEE_STEP_SH 9
+#define XBEE_STEP_SL 10
+#define XBEE_STEP_EXIT 11
+#define XBEE_STEP_READ 12 //batched read of ID, CH, MY, BD and AP (differential configuration)
+#define XBEE_STEP_VR 13
+#define XBEE_STEP_HV 14
+#define JOB_READ_VALUES 5 //lines of the batched read
+
+//bitmap of the fragments
+#define FRAGMENT_IS_SET(bitmap, index) ((bitmap)[(index) >> 3] & (1 << ((index) & 0x07)))
+#define FRAGMENT_SET(bitmap, index) (bitmap)[(index) >> 3] |= (1 << ((index) & 0x07))
+#define FRAGMENT_CLEAR(bitmap, index) (bitmap)[(index) >> 3] &= ~(1 << ((index) & 0x07))
+
+// Samples of the link monitor (after the nodes)
+#define LINK_SAMPLE_EA XBEE_MAX_LINKS
+#define LINK_SAMPLE_EC (XBEE_MAX_LINKS + 1)
+#define LINK_SAMPLE_RR (XBEE_MAX_LINKS + 2) //write of the tuned retries
+#define LINK_SMOOTH(average, sample) (((average) == 0) ? (sample) : ((3 * (average) + (sample)) / 4)) //RSSI (0 if unknown)
+
+//baudrates of the XBee (the index is the value of BD)
+static const long XBEE_BAUDRATES[8] = {1200, 2400, 4800, 9600, 19200, 38400, 57600, 115200};
+
+//parameters of the profiles (the ones that can be read and written, except BD and AP - see XBeeMaster::GetProfile())
+//    NOTE: stored in the flash
+static const char XBEE_PROFILE_PARAMETERS[] PROGMEM = ID CH MY DH DL MM RR RN NT NO CE SC SD A1 A2 EE NI PL CA SM ST SP DP SO NB RO PR
+                                              D0 D1 D2 D3 D4 D5 D6 D7 D8 IU IT IC IR IA T0 T1 T2 T3 T4 T5 T6 T7 P0 P1 PT RP M0 M1 CT GT CC;
+
 
 
 //-------------------------------------------------------------------------------------------------
@@ -84,6 +169,19 @@ XBeeMaster::XBeeMaster(void){
   _xbee = NULL; // BLOCKS the use of the object in Initialize()
   _network_id = NETWORK_ID;
   _network_channel = NETWORK_CHANNEL;
+  _baudrate = BAUDRATE_XBEE;
+  _send_callback = NULL;
+  _request_callback = NULL;
+  _scan_pans = NULL;
+  for(int i=0 ; i < XBEE_HANDLERS ; i++)
+    _handlers[i] = NULL;
+  _frame_id = 0;
+#ifdef XBEE_API_CAPTURE
+  _capture = NULL;
+  _capture_port = 0;
+#endif
+  _job = XBEE_JOB_NONE;
+  _job_result = 0;
 }
 
 #ifdef USE_SOFTWARE_SERIAL
@@ -94,6 +192,19 @@ XBeeMaster::XBeeMaster(SoftwareSerial* xbee){
   _xbee = xbee;
   _network_id = NETWORK_ID;
   _network_channel = NETWORK_CHANNEL;
+  _baudrate = BAUDRATE_XBEE;
+  _send_callback = NULL;
+  _request_callback = NULL;
+  _scan_pans = NULL;
+  for(int i=0 ; i < XBEE_HANDLERS ; i++)
+    _handlers[i] = NULL;
+  _frame_id = 0;
+#ifdef XBEE_API_CAPTURE
+  _capture = NULL;
+  _capture_port = 0;
+#endif
+  _job = XBEE_JOB_NONE;
+  _job_result = 0;
 }
 #else
 // Constructor for HardwareSerial
@@ -103,6 +214,19 @@ XBeeMaster::XBeeMaster(HardwareSerial* xbee){
   _xbee = xbee;
   _network_id = NETWORK_ID;
   _network_channel = NETWORK_CHANNEL;
+  _baudrate = BAUDRATE_XBEE;
+  _send_callback = NULL;
+  _request_callback = NULL;
+  _scan_pans = NULL;
+  for(int i=0 ; i < XBEE_HANDLERS ; i++)
+    _handlers[i] = NULL;
+  _frame_id = 0;
+#ifdef XBEE_API_CAPTURE
+  _capture = NULL;
+  _capture_port = 0;
+#endif
+  _job = XBEE_JOB_NONE;
+  _job_result = 0;
 }
 #endif
 
@@ -115,13 +239,43 @@ XBeeMaster::~XBeeMaster(void){
 
 //-------------------------------------------------------------------------------------------------
 
+// Add a request waiting for the response
+//    (returns the index of the request, XBEE_MAX_REQUESTS if none is free)
+//    NOTE: XBEE_TIMEOUT_AUTO is LISTEN_TIMEOUT here (the requests to the nodes resolve it by the link before)
+byte XBeeMaster::AddRequest(byte type, ByteArray* value, unsigned long timeout){
+  byte index;
+  for(index=0 ; index < XBEE_MAX_REQUESTS ; index++){
+    if(_requests[index].result == 0)
+      break;
+  }
+  if(index == XBEE_MAX_REQUESTS)
+    return index;
+  
+  _requests[index].result = XBEE_REQUEST_PENDING;
+  _requests[index].type = type;
+  _requests[index].frame_id = NextFrameID();
+  _requests[index].address_length = 0;
+  _requests[index].value = value;
+  _requests[index].start_time = millis();
+  _requests[index].timeout = ((timeout == XBEE_TIMEOUT_AUTO) ? LISTEN_TIMEOUT : timeout);
+  _requests[index].sent_time = micros(); //updated when the frame is written (see StampRequest())
+#ifdef XBEE_USE_RETRIES
+  _requests[index].sent.Clear(); //filled by SendRequest()
+  _requests[index].attempt = 1;
+  _requests[index].previous_frame_id = 0;
+  _requests[index].waiting = false;
+#endif
+  
+  return index;
+}
+
+//-------------------------------------------------------------------------------------------------
+
 // Assign a Byte Array to the XBee Master
 boolean XBeeMaster::AssignByteArray(ByteArray* barray){
   if(!_initialized)
     return false;
   
-  _is_SerialNumber = false; //reset because assigning new values
-  
   _barray.ptr = barray->ptr;
   _barray.length = barray->length;
   
@@ -135,707 +289,532 @@ boolean XBeeMaster::AssignByteArray(ByteArray* barray){
     
 //-------------------------------------------------------------------------------------------------
 
-// Calculates the CheckSum of the message
-//    NOTE: the result is in BYTE
-byte XBeeMaster::CheckSum(ByteArray* barray_ptr){
-  long checksum = 0;
-  
-  for(int i=0 ; i < barray_ptr->length ; i++)
-    checksum += barray_ptr->ptr[i];
+// Get the value of BD for the baudrate
+//    (returns 0xFF if invalid baudrate)
+byte XBeeMaster::BaudrateIndex(long baudrate){
+  for(byte i=0 ; i < 8 ; i++){
+    if(XBEE_BAUDRATES[i] == baudrate)
+      return i;
+  }
+  return 0xFF;
+}
+
+//-------------------------------------------------------------------------------------------------
+
+// Cancel a request (the handle is released)
+void XBeeMaster::CancelRequest(byte handle){
+  if(!_initialized)
+    return;
   
-  checksum &= 0xFF;
+  if((handle == 0) || (handle > XBEE_MAX_REQUESTS))
+    return;
   
-  return (0xFF - checksum);
+#ifdef XBEE_USE_NODE_QUEUE
+  FreeByteArray(&_requests[handle - 1].frame); //not sent
+#endif
+#ifdef XBEE_USE_RETRIES
+  _requests[handle - 1].sent.Clear(); //not sent again
+#endif
+  _requests[handle - 1].result = 0; //free
 }
 
 //-------------------------------------------------------------------------------------------------
 
-// Configure current XBee as Master (API mode)
-//    (returns 1 when succesful, 0 if not initialized, 13 if timeout of '+++', 14 if other timeout, 23 if number of tries exeeded, 33 if invalid user Baudrate)
-//    NOTE: if an error as occured, the previous transmission cannot be used, so must restart the transmission with a valid baudrate
-byte XBeeMaster::ConfigureAsMaster(long baudrate){
-  return ConfigureXBee(baudrate, true);
+// Change the baudrate of the XBee and of the connection
+//    (returns TRUE if the link works with the new baudrate)
+//    NOTE: on failure, tries to set the previous baudrate back (the XBee keeps the new one
+//          until reset if the link doesn't work in both directions)
+boolean XBeeMaster::ChangeBaudrate(byte bd){
+  char value[3];
+  value[0] = '0';
+  value[1] = ASCIIByteToHexByte(bd);
+  value[2] = '\0';
+  
+  //the response is sent with the previous baudrate
+  if(WaitRequest(RequestAT(BD, value, NULL, NEGOTIATE_TIMEOUT)) != 1)
+    return false;
+  
+  long previous = _baudrate;
+  delay(10); //give time to apply changes
+  Reopen(XBEE_BAUDRATES[bd]);
+  
+  if(CheckLink(NEGOTIATE_TIMEOUT))
+    return true;
+  
+  //fall back
+  value[1] = ASCIIByteToHexByte(BaudrateIndex(previous));
+  WaitRequest(RequestAT(BD, value, NULL, NEGOTIATE_TIMEOUT));
+  delay(10);
+  Reopen(previous);
+  return false;
 }
 
 //-------------------------------------------------------------------------------------------------
 
-// Configure current XBee as Slave (AT mode)
-//    (returns 1 when succesful, 0 if not initialized, 13 if timeout of '+++', 14 if other timeout, 23 if number of tries exeeded, 33 if invalid user Baudrate)
-//    NOTE: if an error as occured, the previous transmission cannot be used, so must restart the transmission with a valid baudrate
-byte XBeeMaster::ConfigureAsSlave(long baudrate){
-  return ConfigureXBee(baudrate, false);
+// Check the link with the XBee (round trip of an AT command)
+//    (returns TRUE if the response is received)
+boolean XBeeMaster::CheckLink(unsigned long timeout){
+  for(byte i=0 ; i < NEGOTIATE_TRIES ; i++){
+    if(WaitRequest(RequestAT(VR, NULL, NULL, timeout)) == 1)
+      return true;
+  }
+  return false;
 }
 
 //-------------------------------------------------------------------------------------------------
 
-// Configure current XBee as Master (API mode)
-//    (returns 1 when succesful, 0 if not initialized, 13 if timeout of '+++', 14 if other timeout, 23 if number of tries exeeded, 33 if invalid user Baudrate)
-//    NOTE: if an error as occured, the previous transmission cannot be used, so must restart the transmission with a valid baudrate
-byte XBeeMaster::ConfigureXBee(long baudrate, boolean master){
-  if(!_initialized)
-    return 0;
-  
-  // Procedure:
-  //    1) enter command mode
-  //    2) set the network ID
-  //    3) set the network Channel
-  //    4) set the 16-bit address (slave only)
-  //    5) set the Baudrate
-  //    6) set de API mode
-  //    7) write changes
-  //    8.1) read SH
-  //    8.2) read SL
-  //        OBS: address is stored in ByteArray, must read it BEFORE calling other function (might change data in the Byte Array)
-  //    9) exit command mode
-  
-  _xbee->end(); //end previous connection
-  _xbee->begin(baudrate); //begin connection
-  
-#define BUFFER_SIZE 15
-  char c[BUFFER_SIZE]; //add more than 3 to be sure
-  byte count;
-  unsigned long start_time, current_time;
-  byte tries;
-  char* serial_number = "################"; //16 characters
-  //-----------------------------------
-  // 1) ENTER COMMAND MODE
-  tries = 0;
-resend_EnterAT:
-  //check number of tries
-  if(tries > 3)
-    return 23;
-  //reset buffer
-  for(int i=0 ; i < BUFFER_SIZE ; i++)
-    c[i] = EMPTY_CHAR;
-  _xbee->write("+++");
-  tries++;
-  //read response - 'OK\0'
-  count = 0;
-  start_time = millis(); //get the current time
-  current_time = start_time;
-  while((count < 3) && ((current_time - start_time) < AT_TIMEOUT)){
-    if(_xbee->available()){
-      c[count] = _xbee->read();
-      count++;
+#ifdef XBEE_USE_LINK_MONITOR
+// Take the next sample of the link monitor (DB of each node, then EA and EC of the local XBee)
+//    NOTE: one sample at a time, every '_link_interval' milliseconds
+//    NOTE: the retries (RR) are tuned with the sample of EA
+void XBeeMaster::CheckLinks(void){
+  //result of the last sample
+  if(_link_handle != 0){
+    byte res = RequestStatus(_link_handle);
+    if(res == XBEE_REQUEST_PENDING)
+      return;
+    _link_handle = 0;
+    
+    unsigned long value;
+    if((res == 1) && XBeeMessages::DecodeInteger(_link_value.ptr, _link_value.length, &value)){
+      if(_link_sample < XBEE_MAX_LINKS){
+        _links[_link_sample].remote_rssi = LINK_SMOOTH(_links[_link_sample].remote_rssi, value);
+      } else if(_link_sample == LINK_SAMPLE_EA){
+        word failures = (word)value - _link_ack_failures; //since the last sample
+        _link_ack_failures = value;
+        if(_link_tune){
+          //raise when more than 1/4 of the requests failed, lower when none failed
+          byte retries = _link_retries;
+          if(((4UL * failures) > _link_sent) && (retries < LINK_RETRIES_MAX))
+            retries++;
+          else if((failures == 0) && (_link_sent >= LINK_TUNE_SENT) && (retries > 0))
+            retries--;
+          if(retries != _link_retries){
+            char values[3];
+            values[0] = ASCIIByteToHexByte((retries & 0xF0) >> 4);
+            values[1] = ASCIIByteToHexByte(retries & 0x0F);
+            values[2] = '\0';
+            ResizeByteArray(&_link_value, 1);
+            _link_value.ptr[0] = retries; //stored when the write is confirmed
+            _link_handle = RequestAT(RR, values, NULL);
+            _link_sample = LINK_SAMPLE_RR;
+          }
+        }
+        _link_sent = 0;
+      } else if(_link_sample == LINK_SAMPLE_EC){
+        _link_cca_failures = value;
+      } else { //LINK_SAMPLE_RR
+        _link_retries = value;
+      }
     }
-    current_time = millis();
+    if(_link_handle == 0)
+      FreeByteArray(&_link_value);
+    return;
   }
-  //check if timeout
-  if((current_time - start_time) >= AT_TIMEOUT)
-    return 13;
-#ifdef XBEE_API_DEBUG
-  //display on computer
-  if(_use_computer){
-    _computer->println(">> +++");
-    for(int i=0 ; i < BUFFER_SIZE ; i++)
-      _computer->print(c[i]);
-    _computer->println();
-  }
-#endif
-  if((c[0] != 0x4F) || (c[1] != 0x4B) || (c[2] != 0x0D)) //not 'OK' resend
-    goto resend_EnterAT;
-  //-----------------------------------
-  // 2) SET NETWORK ID
-  tries = 0;
-resend_ID:
-  //check number of tries
-  if(tries > 3)
-    return 23;
-  //reset buffer
-  for(int i=0 ; i < BUFFER_SIZE ; i++)
-    c[i] = EMPTY_CHAR;
-  _xbee->write("ATID");
-  _xbee->write(ASCIIByteToHexByte((_network_id & 0xF000) >> 12));
-  _xbee->write(ASCIIByteToHexByte((_network_id & 0x0F00) >> 8));
-  _xbee->write(ASCIIByteToHexByte((_network_id & 0x00F0) >> 4));
-  _xbee->write(ASCIIByteToHexByte(_network_id & 0x000F));
-  _xbee->write(0x0D); //carriage return
-  tries++; //add
-  //read response - 'OK\0'
-  count = 0;
-  start_time = millis(); //get the current time
-  current_time = start_time;
-  while((count < 3) && ((current_time - start_time) < AT_TIMEOUT)){
-    if(_xbee->available()){
-      c[count] = _xbee->read();
-      count++;
-    }
-    current_time = millis();
+  
+  if((_link_interval == 0) || ((millis() - _link_time) < _link_interval))
+    return;
+  _link_time = millis();
+  
+  //next node with a link, then EA and EC
+  if(_link_sample == LINK_SAMPLE_RR){
+    _link_sample = LINK_SAMPLE_EC;
+  } else {
+    do{
+      _link_sample++;
+      if(_link_sample > LINK_SAMPLE_EC)
+        _link_sample = 0;
+    } while((_link_sample < XBEE_MAX_LINKS) && (_links[_link_sample].address_length == 0));
   }
-  //check if timeout
-  if((current_time - start_time) >= AT_TIMEOUT)
-    return 14;
-#ifdef XBEE_API_DEBUG
-  //display on computer
-  if(_use_computer){
-    _computer->println(">> ATID");
-    for(int i=0 ; i < BUFFER_SIZE ; i++)
-      _computer->print(c[i]);
-    _computer->println();
-  }
-#endif
-  if((c[0] != 0x4F) || (c[1] != 0x4B) || (c[2] != 0x0D)) //not 'OK' resend
-    goto resend_ID;
-  //-----------------------------------
-  // 3) SET NETWORK CHANNEL
-  tries = 0;
-resend_CH:
-  //check number of tries
-  if(tries > 3)
-    return 23;
-  //reset buffer
-  for(int i=0 ; i < BUFFER_SIZE ; i++)
-    c[i] = EMPTY_CHAR;
-  _xbee->write("ATCH");
-  _xbee->write(ASCIIByteToHexByte((_network_channel & 0x00F0) >> 4));
-  _xbee->write(ASCIIByteToHexByte(_network_channel & 0x000F));
-  _xbee->write(0x0D); //carriage return
-  tries++; //add
-  //read response - 'OK\0'
-  count = 0;
-  start_time = millis(); //get the current time
-  current_time = start_time;
-  while((count < 3) && ((current_time - start_time) < AT_TIMEOUT)){
-    if(_xbee->available()){
-      c[count] = _xbee->read();
-      count++;
+  
+  if(_link_sample == LINK_SAMPLE_EA){
+    _link_handle = RequestAT(EA, NULL, &_link_value);
+  } else if(_link_sample == LINK_SAMPLE_EC){
+    _link_handle = RequestAT(EC, NULL, &_link_value);
+  } else {
+    //RSSI of the last frame received by the node (the response is also a sample of the round trip time)
+    XBeeLink* link = &_links[_link_sample];
+    byte index = AddRequest(API_REMOTE_AT_COMMAND_REQUEST, &_link_value, LinkTimeout(link->address, link->address_length));
+    if(index == XBEE_MAX_REQUESTS)
+      return;
+    
+    ByteArray message;
+    InitializeByteArray(&message);
+    ResizeByteArray(&message, 15);
+    message.ptr[0] = API_REMOTE_AT_COMMAND_REQUEST;
+    if(link->address_length == 8){
+      for(int i=0 ; i < 8 ; i++)
+        message.ptr[2+i] = link->address[i];
+      message.ptr[10] = 0xFF;
+      message.ptr[11] = 0xFE;
+    } else {
+      for(int i=0 ; i < 8 ; i++)
+        message.ptr[2+i] = 0xFF; //unknown 64-bit address
+      message.ptr[10] = link->address[0];
+      message.ptr[11] = link->address[1];
     }
-    current_time = millis();
+    message.ptr[12] = XBEE_REMOTE_APPLY;
+    message.ptr[13] = 'D';
+    message.ptr[14] = 'B';
+    memcpy(_requests[index].address, link->address, link->address_length);
+    _requests[index].address_length = link->address_length;
+    _link_handle = SendRequest(index, &message);
   }
-  //check if timeout
-  if((current_time - start_time) >= AT_TIMEOUT)
-    return 14;
-#ifdef XBEE_API_DEBUG
-  //display on computer
-  if(_use_computer){
-    _computer->println(">> ATCH");
-    for(int i=0 ; i < BUFFER_SIZE ; i++)
-      _computer->print(c[i]);
-    _computer->println();
-  }
-#endif
-  if((c[0] != 0x4F) || (c[1] != 0x4B) || (c[2] != 0x0D)) //not 'OK' resend
-    goto resend_CH;
-  //-----------------------------------
-  // 4) SET 16-bit ADDRESS
-  if(!master){
-    tries = 0;
-resend_MY:
-    //check number of tries
-    if(tries > 3)
-      return 23;
-    //reset buffer
-    for(int i=0 ; i < BUFFER_SIZE ; i++)
-      c[i] = EMPTY_CHAR;
-    _xbee->write("ATMY");
-    _xbee->write("FFFF"); // 0xFFFF
-    _xbee->write(0x0D); //carriage return
-    tries++; //add
-    //read response - 'OK\0'
-    count = 0;
-    start_time = millis(); //get the current time
-    current_time = start_time;
-    while((count < 3) && ((current_time - start_time) < AT_TIMEOUT)){
-      if(_xbee->available()){
-        c[count] = _xbee->read();
-        count++;
-      }
-      current_time = millis();
-    }
-    //check if timeout
-    if((current_time - start_time) >= AT_TIMEOUT)
-      return 14;
-#ifdef XBEE_API_DEBUG
-    //display on computer
-    if(_use_computer){
-      _computer->println(">> ATMY");
-      for(int i=0 ; i < BUFFER_SIZE ; i++)
-        _computer->print(c[i]);
-      _computer->println();
-    }
+}
+
+//-------------------------------------------------------------------------------------------------
+#endif // XBEE_USE_LINK_MONITOR
+
+#ifdef XBEE_API_CAPTURE
+// Write a raw frame in the capture
+//    NOTE: each record is 0xCA, port ID (bit 7 set for received frames), time in microseconds
+//          (4 bytes, LSB first), length (2 bytes, LSB first) and the bytes of the frame
+//    NOTE: the time of the received frames is the one of their first byte (see GetFrameTime())
+void XBeeMaster::Capture(boolean received, byte* frame, int length){
+  if(_capture == NULL)
+    return;
+  
+  unsigned long time = (received ? _rx_time : micros());
+  byte header[8];
+  header[0] = XBEE_CAPTURE_RECORD;
+  header[1] = (_capture_port & 0x7F) | (received ? 0x80 : 0x00);
+  header[2] = time & 0xFF;
+  header[3] = (time >> 8) & 0xFF;
+  header[4] = (time >> 16) & 0xFF;
+  header[5] = (time >> 24) & 0xFF;
+  header[6] = length & 0xFF;
+  header[7] = (length >> 8) & 0xFF;
+  _capture->write(header, 8);
+  _capture->write(frame, length);
+}
+
+//-------------------------------------------------------------------------------------------------
+#endif // XBEE_API_CAPTURE
+
+// Calculates the CheckSum of the message
+//    NOTE: the result is in BYTE
+byte XBeeMaster::CheckSum(ByteArray* barray_ptr){
+  return CheckSum(barray_ptr->ptr, barray_ptr->length);
+}
+
+
+// Calculates the CheckSum of the message
+//    NOTE: the result is in BYTE
+byte XBeeMaster::CheckSum(byte* ptr, int length){
+  long checksum = 0;
+  
+  for(int i=0 ; i < length ; i++)
+    checksum += ptr[i];
+  
+  checksum &= 0xFF;
+  
+  return (0xFF - checksum);
+}
+
+//-------------------------------------------------------------------------------------------------
+
+#ifdef XBEE_USE_FRAGMENTS
+// Send the next fragment and check the timeout of the messages
+void XBeeMaster::CheckMessages(void){
+  unsigned long current_time = millis();
+  
+  XBeeLongMessage* message = &_message_tx;
+  if(message->result == XBEE_REQUEST_PENDING){
+    while((message->next < message->count) && !FRAGMENT_IS_SET(message->bitmap, message->next))
+      message->next++;
+    if(message->next < message->count){
+      //one fragment at a time (with XBEE_USE_TX_QUEUE, after the previous one left the queue)
+#ifdef XBEE_USE_TX_QUEUE
+      if(((current_time - message->time) >= FRAGMENT_INTERVAL) && !IsQueued(XBEE_PRIORITY_BULK)){
+#else
+      if((current_time - message->time) >= FRAGMENT_INTERVAL){
 #endif
-    if((c[0] != 0x4F) || (c[1] != 0x4B) || (c[2] != 0x0D)) //not 'OK' resend
-      goto resend_MY;
-  }
-  //-----------------------------------
-  // 5) SET NETWORK BAUDRATE
-  byte bd;
-  switch(BAUDRATE_XBEE){
-    case 1200: bd = 0; break;
-    case 2400: bd = 1; break;
-    case 4800: bd = 2; break;
-    case 9600: bd = 3; break;
-    case 19200: bd = 4; break;
-    case 38400: bd = 5; break;
-    case 57600: bd = 6; break;
-    case 115200: bd = 7; break;
-    default: bd = 13;
-  }
-  //check if valid baudrate
-  if(bd == 13)
-    return 33;
-  //continue
-  tries = 0;
-resend_BD:
-  //check number of tries
-  if(tries > 3)
-    return 23;
-  //reset buffer
-  for(int i=0 ; i < BUFFER_SIZE ; i++)
-    c[i] = EMPTY_CHAR;
-  _xbee->write("ATBD");
-  _xbee->write(ASCIIByteToHexByte(bd));
-  _xbee->write(0x0D); //carriage return
-  tries++; //add
-  //read response - 'OK\0'
-  count = 0;
-  start_time = millis(); //get the current time
-  current_time = start_time;
-  while((count < 3) && ((current_time - start_time) < AT_TIMEOUT)){
-    if(_xbee->available()){
-      c[count] = _xbee->read();
-      count++;
-    }
-    current_time = millis();
-  }
-  //check if timeout
-  if((current_time - start_time) >= AT_TIMEOUT)
-    return 14;
-#ifdef XBEE_API_DEBUG
-  //display on computer
-  if(_use_computer){
-    _computer->println(">> ATBD");
-    for(int i=0 ; i < BUFFER_SIZE ; i++)
-      _computer->print(c[i]);
-    _computer->println();
-  }
-#endif
-  if((c[0] != 0x4F) || (c[1] != 0x4B) || (c[2] != 0x0D)) //not 'OK' resend
-    goto resend_BD;
-  //-----------------------------------
-  // 6) SET API MODE
-  tries = 0;
-resend_AP:
-  //check number of tries
-  if(tries > 3)
-    return 23;
-  //reset buffer
-  for(int i=0 ; i < BUFFER_SIZE ; i++)
-    c[i] = EMPTY_CHAR;
-  if(master)
-    _xbee->write("ATAP1"); //mode 1 (mode 2 not yet implemented in XBeeMessages - see README)
-  else
-    _xbee->write("ATAP0");
-  _xbee->write(0x0D); //carriage return
-  tries++; //add
-  //read response - 'OK\0'
-  count = 0;
-  start_time = millis(); //get the current time
-  current_time = start_time;
-  while((count < 3) && ((current_time - start_time) < AT_TIMEOUT)){
-    if(_xbee->available()){
-      c[count] = _xbee->read();
-      count++;
+        byte index = message->next;
+        int offset = index * XBEE_FRAGMENT_SIZE;
+        int length = message->data->length - offset;
+        if(length > XBEE_FRAGMENT_SIZE)
+          length = XBEE_FRAGMENT_SIZE;
+        SendFragment(message->address, message->address_length, XBEE_FRAGMENT_DATA, message->message_id, index, message->count, &message->data->ptr[offset], length);
+        FRAGMENT_CLEAR(message->bitmap, index);
+        message->next++;
+        message->time = current_time;
+      }
+    } else if((current_time - message->time) >= FRAGMENT_TIMEOUT){
+      //no response, send the last fragment again to get the ACK or the missing fragments
+      message->tries++;
+      if(message->tries > FRAGMENT_TRIES){
+        XBEE_STATS_ADD(timeouts);
+        message->result = XBEE_REQUEST_TIMEOUT;
+      } else {
+        XBEE_STATS_ADD(retries);
+        message->next = message->count - 1;
+        FRAGMENT_SET(message->bitmap, message->next);
+      }
     }
-    current_time = millis();
   }
-  //check if timeout
-  if((current_time - start_time) >= AT_TIMEOUT)
-    return 14;
-#ifdef XBEE_API_DEBUG
-  //display on computer
-  if(_use_computer){
-    _computer->println(">> ATPn");
-    for(int i=0 ; i < BUFFER_SIZE ; i++)
-      _computer->print(c[i]);
-    _computer->println();
-  }
-#endif
-  if((c[0] != 0x4F) || (c[1] != 0x4B) || (c[2] != 0x0D)) //not 'OK' resend
-    goto resend_AP;
-  //-----------------------------------
-  // 7) WRITE CHANGES TO XBEE
-  tries = 0;
-resend_WR:
-  if(tries > 3)
-    return 23;
-  //reset buffer
-  for(int i=0 ; i < BUFFER_SIZE ; i++)
-    c[i] = EMPTY_CHAR;
-  _xbee->write("ATWR");
-  _xbee->write(0x0D); //carriage return
-  tries++; //add
-  //read response - 'OK\0'
-  count = 0;
-  start_time = millis(); //get the current time
-  current_time = start_time;
-  while((count < 3) && ((current_time - start_time) < AT_TIMEOUT)){
-    if(_xbee->available()){
-      c[count] = _xbee->read();
-      count++;
-    }
-    current_time = millis();
+  
+  //discard the incomplete message
+  message = &_message_rx;
+  if((message->result == XBEE_REQUEST_PENDING) && ((current_time - message->time) >= (FRAGMENT_TIMEOUT * (FRAGMENT_TRIES + 1)))){
+    XBEE_STATS_ADD(timeouts);
+    FreeByteArray(message->data);
+    message->result = 0; //free
   }
-  //check if timeout
-  if((current_time - start_time) >= AT_TIMEOUT)
-    return 14;
-#ifdef XBEE_API_DEBUG
-  //display on computer
-  if(_use_computer){
-    _computer->println(">> ATWR");
-    for(int i=0 ; i < BUFFER_SIZE ; i++)
-      _computer->print(c[i]);
-    _computer->println();
-  }
-#endif
-  if((c[0] != 0x4F) || (c[1] != 0x4B) || (c[2] != 0x0D)) //not 'OK' resend
-    goto resend_WR;
-  //-----------------------------------
-  // 8.1) READ SH
-  tries = 0;
-resend_SH:
-  if(tries > 3)
-    return 23;
-  //reset buffer
-  for(int i=0 ; i < BUFFER_SIZE ; i++)
-    c[i] = EMPTY_CHAR;
-  _xbee->write("ATSH");
-  _xbee->write(0x0D); //carriage return
-  tries++; //add
-  //read response - 'OK\0'
-  count = 0;
-  start_time = millis(); //get the current time
-  current_time = start_time;
-  while((count < 9) && ((current_time - start_time) < AT_TIMEOUT)){
-    if(_xbee->available()){
-      c[count] = _xbee->read();
-      count++; //careful for next commands!
-    }
-    current_time = millis();
-    //exit if found carriage return before end (meaning first bytes are 0)
-    if(c[count - 1] == 0x0D){
-      //ignore next characters
-      while(_xbee->available()){
-        _xbee->read();
-      }
-      break;
+}
+
+//-------------------------------------------------------------------------------------------------
+#endif // XBEE_USE_FRAGMENTS
+
+// Check the timeout of the pending requests
+//    NOTE: with XBEE_USE_RETRIES, also sends again the requests whose backoff has passed
+//    NOTE: with XBEE_USE_NODE_QUEUE, the held requests wait for the destination to wake up
+//          (up to the learned period plus the time awake, see SetSleepingNode()), then are sent (see SendHeld())
+void XBeeMaster::CheckRequests(void){
+#ifdef XBEE_USE_NODE_QUEUE
+  SendHeld(); //of the nodes that woke up
+#endif
+  unsigned long current_time = millis();
+  for(byte i=0 ; i < XBEE_MAX_REQUESTS ; i++){
+    if(_requests[i].result != XBEE_REQUEST_PENDING)
+      continue;
+#ifdef XBEE_USE_RETRIES
+    if(_requests[i].waiting){
+      if((long)(current_time - _requests[i].retry_time) >= 0)
+        ResendRequest(i);
+      continue;
     }
-  }
-  //check if timeout
-  if((current_time - start_time) >= AT_TIMEOUT)
-    return 14;
-#ifdef XBEE_API_DEBUG
-  //display on computer
-  if(_use_computer){
-    _computer->println(">> ATSH");
-    for(int i=0 ; i < BUFFER_SIZE ; i++)
-      _computer->print(c[i]);
-    _computer->println();
-  }
-#endif
-  if(c[count - 1] != 0x0D) //invalid response
-    goto resend_SH;
-  else { //store in serial_number MSB
-    byte leading_zeros = 9 - count;
-    for(int i=0 ; i < leading_zeros ; i++)
-      serial_number[i] = '0';
-    for(int i=leading_zeros ; i < 8 ; i++)
-      serial_number[i] = c[i - leading_zeros];
-  }
-  //-----------------------------------
-  // 8.2) READ SL
-  tries = 0;
-resend_SL:
-  if(tries > 3)
-    return 23;
-  //reset buffer
-  for(int i=0 ; i < BUFFER_SIZE ; i++)
-    c[i] = EMPTY_CHAR;
-  _xbee->write("ATSL");
-  _xbee->write(0x0D); //carriage return
-  tries++; //add
-  //read response - 'OK\0'
-  count = 0;
-  start_time = millis(); //get the current time
-  current_time = start_time;
-  while((count < 9) && ((current_time - start_time) < AT_TIMEOUT)){
-    if(_xbee->available()){
-      c[count] = _xbee->read();
-      count++; //careful for next commands!
+#endif
+    unsigned long timeout = _requests[i].timeout;
+#ifdef XBEE_USE_NODE_QUEUE
+    if(_requests[i].frame.length > 0){ //held (the timeout starts again when sent, see WakeNode())
+      byte node = FindDestination(&_requests[i].frame);
+      if((node == XBEE_MAX_NODES) || (_nodes[node].period == 0)) //the next wake up is unknown
+        continue;
+      timeout += _nodes[node].period + _nodes[node].awake_time; //missed the next wake up
     }
-    current_time = millis();
-    //exit if found carriage return before end (meaning first bytes are 0)
-    if(c[count - 1] == 0x0D){
-      //ignore next characters
-      while(_xbee->available()){
-        _xbee->read();
-      }
-      break;
+#endif
+    if((current_time - _requests[i].start_time) >= timeout){
+      XBEE_STATS_ADD(timeouts);
+      CompleteRequest(i, XBEE_REQUEST_TIMEOUT, NULL, 0);
     }
   }
-  //check if timeout
-  if((current_time - start_time) >= AT_TIMEOUT)
-    return 14;
-#ifdef XBEE_API_DEBUG
-  //display on computer
-  if(_use_computer){
-    _computer->println(">> ATSL");
-    for(int i=0 ; i < BUFFER_SIZE ; i++)
-      _computer->print(c[i]);
-    _computer->println();
-  }
-#endif
-  if(c[count - 1] != 0x0D) //invalid response
-    goto resend_SL;
-  else { //store in serial_number LSB (see offset of 8)
-    byte leading_zeros = 9 - count;
-    for(int i=0 ; i < leading_zeros ; i++)
-      serial_number[8 + i] = '0';
-    for(int i=leading_zeros ; i < 8 ; i++)
-      serial_number[8 + i] = c[i - leading_zeros];
-  }
-  //-----------------------------------
-  // 9) EXIT COMMAND MODE
-  _xbee->write("ATCN"); //leave command mode - doesn't need to verify 'ok' back, leaves with timeout
-  _xbee->write(0x0D); //carriage return
-#ifdef XBEE_API_DEBUG
-  //display on computer
-  if(_use_computer)
-    _computer->println(">> ATCN");
-#endif
-#undef BUFFER_SIZE
-  //-----------------------------------
-  // return
-  delay(10);
-  _xbee->flush();
-  _xbee->end();
-  _xbee->begin(BAUDRATE_XBEE); //start new connection
-  
-  //store in ByteArray
-  HexStringToByteArray(serial_number, &_barray);
-  _is_SerialNumber = true; //set
-  
-  return 1;
 }
 
 //-------------------------------------------------------------------------------------------------
 
-// Configure the pins
-//    (returns 1 when succesful, 0 if not initialized, 13 if timeout of '+++', 14 if other timeout,
-//      23 if number of tries exeeded, 30 if invalid number of pins
-//    NOTE: if an error as occured, the previous transmission cannot be used, so must restart the transmission with a valid baudrate
-byte XBeeMaster::ConfigurePins(XBeePin *pins, byte num_pins){
-  if(!_initialized)
-    return 0;
-  
-  //check number of pins
-  if((num_pins == 0) || (num_pins > 9))
-    return 30;
-  
-  // Procedure:
-  //    1) enter command mode
-  //    2) configure
-  //    3) write changes (if aplicable)
-  //    4) exit command mode
+// Complete a request, storing the data of the response
+//    NOTE: the round trip time is measured with micros(), from the end of the transmission (see StampRequest()) to the first byte of the response
+//    NOTE: with XBEE_USE_RETRIES, the request stays pending if it's going to be sent again (see RetryRequest())
+void XBeeMaster::CompleteRequest(byte index, byte result, byte* data, int length){
+  XBeeRequest* request = &_requests[index];
+#if defined(XBEE_USE_RETRIES) || defined(XBEE_USE_LINK_MONITOR) || defined(XBEE_API_STATS)
+  //round trip time from the end of the transmission to the first byte of the response (the timeout without response)
+  unsigned long rtt = millis() - request->start_time;
+  if(data != NULL)
+    rtt = (((long)(_rx_time - request->sent_time) > 0) ? ((_rx_time - request->sent_time) / 1000) : 0);
+#endif
+#ifdef XBEE_USE_RETRIES
+  if(RetryRequest(index, result, rtt))
+    return;
+  request->sent.Clear();
+  request->waiting = false;
+#endif
+#ifdef XBEE_USE_NODE_QUEUE
+  FreeByteArray(&request->frame); //not sent before the timeout
+#endif
   
-  boolean wr = false; //TRUE if has to write the changes
-  
-#define BUFFER_SIZE 15
-  char c[BUFFER_SIZE]; //add more than 3 to be sure
-  byte count;
-  unsigned long start_time, current_time;
-  byte tries;
-  //-----------------------------------
-  // 1) ENTER COMMAND MODE
-  tries = 0;
-resend_EnterAT:
-  //check number of tries
-  if(tries > 3)
-    return 23;
-  //reset buffer
-  for(int i=0 ; i < BUFFER_SIZE ; i++)
-    c[i] = EMPTY_CHAR;
-  _xbee->write("+++");
-  tries++;
-  //read response - 'OK\0'
-  count = 0;
-  start_time = millis(); //get the current time
-  current_time = start_time;
-  while((count < 3) && ((current_time - start_time) < AT_TIMEOUT)){
-    if(_xbee->available()){
-      c[count] = _xbee->read();
-      count++;
+  if((request->value != NULL) && (data != NULL)){
+    if(length > 0){
+      ResizeByteArray(request->value, length);
+      for(int i=0 ; i < length ; i++)
+        request->value->ptr[i] = data[i];
+    } else {
+      FreeByteArray(request->value);
     }
-    current_time = millis();
   }
-  //check if timeout
-  if((current_time - start_time) >= AT_TIMEOUT)
-    return 13;
-#ifdef XBEE_API_DEBUG
-  //display on computer
-  if(_use_computer){
-    _computer->println(">> +++");
-    for(int i=0 ; i < BUFFER_SIZE ; i++)
-      _computer->print(c[i]);
-    _computer->println();
-  }
-#endif
-  if((c[0] != 0x4F) || (c[1] != 0x4B) || (c[2] != 0x0D)) //not 'OK' resend
-    goto resend_EnterAT;
-  //-----------------------------------
-  // 2) CONFIGURE
-  for(int current=0 ; current < num_pins ; current++){
-    tries = 0;
-resend_Dn:
-    //check number of tries
-    if(tries > 3)
-      return 23;
-    //reset buffer
-    for(int i=0 ; i < BUFFER_SIZE ; i++)
-      c[i] = EMPTY_CHAR;
-  
-    _xbee->write('A');
-    _xbee->write('T');
-    _xbee->write(pins[current].pin[0]);
-    _xbee->write(pins[current].pin[1]);
-    _xbee->write(pins[current].value + 48); //use '0' instead of 0
-    
-    _xbee->write(0x0D); //carriage return
-    tries++; //add
-    //read response - 'OK\0'
-    count = 0;
-    start_time = millis(); //get the current time
-    current_time = start_time;
-    while((count < 3) && ((current_time - start_time) < AT_TIMEOUT)){
-      if(_xbee->available()){
-        c[count] = _xbee->read();
-        count++;
-      }
-      current_time = millis();
-    }
-    //check if timeout
-    if((current_time - start_time) >= AT_TIMEOUT)
-      return 14;
-#ifdef XBEE_API_DEBUG
-    //display on computer
-    if(_use_computer){
-      _computer->print(">> AT");
-      _computer->println(pins[current].pin);
-      for(int i=0 ; i < BUFFER_SIZE ; i++)
-        _computer->print(c[i]);
-      _computer->println();
-    }
+  request->result = result;
+  XBEE_TRACE(XBEE_TRACE_REQUEST_END, index + 1, result, request->type);
+#ifdef XBEE_USE_LINK_MONITOR
+  //statistics of the link with the destination (with the response or on timeout)
+  if((request->address_length > 0) && ((data != NULL) || (result == XBEE_REQUEST_TIMEOUT))){
+    if((request->type == API_REMOTE_AT_COMMAND_REQUEST) || (request->type == API_TX_RESQUEST_64_BIT) || (request->type == API_TX_RESQUEST_16_BIT))
+      UpdateLink(request->address, request->address_length, result, rtt);
+  }
 #endif
-    if((c[0] != 0x4F) || (c[1] != 0x4B) || (c[2] != 0x0D)) //not 'OK' resend
-      goto resend_Dn;
-    
-    wr = true; //one pin has been configured successfully
-  }
-  //-----------------------------------
-  // 3) WRITE CHANGES TO XBEE
-  if(wr){
-    tries = 0;
-resend_WR:
-    if(tries > 3)
-      return 23;
-    //reset buffer
-    for(int i=0 ; i < BUFFER_SIZE ; i++)
-      c[i] = EMPTY_CHAR;
-    _xbee->write("ATWR");
-    _xbee->write(0x0D); //carriage return
-    tries++; //add
-    //read response - 'OK\0'
-    count = 0;
-    start_time = millis(); //get the current time
-    current_time = start_time;
-    while((count < 3) && ((current_time - start_time) < AT_TIMEOUT)){
-      if(_xbee->available()){
-        c[count] = _xbee->read();
-        count++;
-      }
-      current_time = millis();
+#ifdef XBEE_API_STATS
+  //round trip time of the requests with response
+  if(data != NULL){
+    byte rtt_type = XBEE_STATS_RTT_TYPES;
+    switch(request->type){
+      case API_AT_COMMAND:
+      case API_AT_COMMAND_QUEUE: rtt_type = XBEE_STATS_RTT_AT; break;
+      case API_REMOTE_AT_COMMAND_REQUEST: rtt_type = XBEE_STATS_RTT_REMOTE_AT; break;
+      case API_TX_RESQUEST_64_BIT:
+      case API_TX_RESQUEST_16_BIT: rtt_type = XBEE_STATS_RTT_TX; break;
     }
-    //check if timeout
-    if((current_time - start_time) >= AT_TIMEOUT)
-      return 14;
-#ifdef XBEE_API_DEBUG
-    //display on computer
-    if(_use_computer){
-      _computer->println(">> ATWR");
-      for(int i=0 ; i < BUFFER_SIZE ; i++)
-        _computer->print(c[i]);
-      _computer->println();
+    if(rtt_type < XBEE_STATS_RTT_TYPES){
+      word* bucket = &_stats.rtt[rtt_type][StatsBucket(rtt)];
+      if(*bucket < 0xFFFF)
+        (*bucket)++;
     }
-#endif
-    if((c[0] != 0x4F) || (c[1] != 0x4B) || (c[2] != 0x0D)) //not 'OK' resend
-      goto resend_WR;
   }
-  //-----------------------------------
-  // 4) EXIT COMMAND MODE
-  _xbee->write("ATCN"); //leave command mode - doesn't need to verify 'ok' back, leaves with timeout
-  _xbee->write(0x0D); //carriage return
-#ifdef XBEE_API_DEBUG
-  //display on computer
-  if(_use_computer)
-    _computer->println(">> ATCN");
 #endif
-#undef BUFFER_SIZE
-  //-----------------------------------
   
-  return 1;
+  if(_request_callback != NULL)
+    _request_callback(index + 1, result);
 }
 
 //-------------------------------------------------------------------------------------------------
 
-// Create the message
-boolean XBeeMaster::CreateFrame(char* message, boolean is_hex){
-  if(!_initialized)
+// Compare the values of the batched read with the configuration
+//    (returns FALSE if invalid response)
+//    NOTE: the reply has ID, CH, MY, BD and AP in HEX format, one line each
+//    NOTE: sets the bit of each step to change in '_job_diff'
+boolean XBeeMaster::CompareJobValues(void){
+  unsigned long values[JOB_READ_VALUES];
+  byte line = 0;
+  byte digits = 0;
+  values[0] = 0;
+  for(byte i=0 ; i < _job_count ; i++){
+    char c = _job_reply[i];
+    if(c == 0x0D){ //end of the value
+      if(digits == 0)
+        return false;
+      line++;
+      if(line == JOB_READ_VALUES)
+        break;
+      values[line] = 0;
+      digits = 0;
+      continue;
+    }
+    
+    int digit = HexDigit(c);
+    if(digit < 0)
+      return false;
+    values[line] = (values[line] << 4) | digit;
+    digits++;
+  }
+  if(line < JOB_READ_VALUES)
     return false;
   
-  //convert message to Byte Array
-  ByteArray temp;
-  InitializeByteArray(&temp);
-  if(is_hex)
-    HexStringToByteArray(message, &temp);
-  else
-    StringToByteArray(message, &temp);
-  
-  //calculate the check sum
-  byte check_sum = CheckSum(&temp);
-  
-  //free Byte Array if contains the Serial Number
-  if(_is_SerialNumber)
-    FreeByteArray(&_barray);
-  
-  //store in own Byte Array
-  ResizeByteArray(&_barray, 3);
-  JoinByteArray(&_barray, &temp); //add to own byte array
-  FreeByteArray(&temp); //free memory
-  
-  //change message
-  ResizeByteArray(&_barray, (_barray.length + 1)); //+1 to insert the check sum
-  _barray.ptr[0] = FRAME_DELIMITER;
-  _barray.ptr[1] = ((_barray.length - 4) & 0xFF00);
-  _barray.ptr[2] = ((_barray.length - 4) & 0x00FF);
-  _barray.ptr[_barray.length - 1] = check_sum;
+  _job_diff = 0;
+  if(values[0] != _network_id)
+    _job_diff |= (1 << XBEE_STEP_ID);
+  if(values[1] != _network_channel)
+    _job_diff |= (1 << XBEE_STEP_CH);
+  if(!_job_master && (values[2] != 0xFFFF)) //16-bit address for slave only
+    _job_diff |= (1 << XBEE_STEP_MY);
+  if(values[3] != _job_bd)
+    _job_diff |= (1 << XBEE_STEP_BD);
+  if(values[4] != (_job_master ? 1 : 0))
+    _job_diff |= (1 << XBEE_STEP_AP);
   
   return true;
 }
 
-//------------------------------------------
+//-------------------------------------------------------------------------------------------------
+
+// Configure current XBee as Master (API mode)
+//    (returns 1 when succesful, 0 if not initialized, 13 if timeout of '+++', 14 if other timeout, 23 if number of tries exeeded, 33 if invalid user Baudrate)
+//    NOTE: if an error as occured, the previous transmission cannot be used, so must restart the transmission with a valid baudrate
+//    NOTE: with 'differential', only the parameters with different values are set (and written only if any was set)
+byte XBeeMaster::ConfigureAsMaster(long baudrate, boolean differential){
+  return ConfigureXBee(baudrate, true, differential);
+}
+
+//-------------------------------------------------------------------------------------------------
+
+// Configure current XBee as Slave (AT mode)
+//    (returns 1 when succesful, 0 if not initialized, 13 if timeout of '+++', 14 if other timeout, 23 if number of tries exeeded, 33 if invalid user Baudrate)
+//    NOTE: if an error as occured, the previous transmission cannot be used, so must restart the transmission with a valid baudrate
+//    NOTE: with 'differential', only the parameters with different values are set (and written only if any was set)
+byte XBeeMaster::ConfigureAsSlave(long baudrate, boolean differential){
+  return ConfigureXBee(baudrate, false, differential);
+}
+
+//-------------------------------------------------------------------------------------------------
+
+// Configure current XBee as Master (API mode)
+//    (returns 1 when succesful, 0 if not initialized, 13 if timeout of '+++', 14 if other timeout, 23 if number of tries exeeded, 33 if invalid user Baudrate)
+//    NOTE: if an error as occured, the previous transmission cannot be used, so must restart the transmission with a valid baudrate
+//    NOTE: blocks until the job is finished (see StartConfigureAsMaster() and Poll() for the non blocking version)
+byte XBeeMaster::ConfigureXBee(long baudrate, boolean master, boolean differential){
+  byte res = StartConfigureXBee(baudrate, master, differential);
+  while(res == XBEE_JOB_BUSY)
+    res = Poll();
+  
+  return res;
+}
+
+//-------------------------------------------------------------------------------------------------
+
+// Configure the pins
+//    (returns 1 when succesful, 0 if not initialized, 13 if timeout of '+++', 14 if other timeout,
+//      23 if number of tries exeeded, 30 if invalid number of pins
+//    NOTE: if an error as occured, the previous transmission cannot be used, so must restart the transmission with a valid baudrate
+//    NOTE: blocks until the job is finished (see StartConfigurePins() and Poll() for the non blocking version)
+byte XBeeMaster::ConfigurePins(XBeePin *pins, byte num_pins){
+  byte res = StartConfigurePins(pins, num_pins);
+  while(res == XBEE_JOB_BUSY)
+    res = Poll();
+  
+  return res;
+}
+
+//-------------------------------------------------------------------------------------------------
+
+// Create the message
+boolean XBeeMaster::CreateFrame(char* message, boolean is_hex){
+  if(!_initialized)
+    return false;
+  
+  //convert message to Byte Array
+  ByteArray temp;
+  InitializeByteArray(&temp);
+  if(is_hex)
+    HexStringToByteArray(message, &temp);
+  else
+    StringToByteArray(message, &temp);
+  
+  return CreateFrame(&temp); //frees the Byte Array
+}
+
+//------------------------------------------
 
 // Create the message
+//    (returns FALSE if not initialized or if the frame is bigger than XBEE_TX_BUFFER_SIZE)
+//    NOTE: 'message' is freed
+//    NOTE: the frame is kept until sent by Send() (the requests are sent in their own frames)
 boolean XBeeMaster::CreateFrame(ByteArray* message){
   if(!_initialized)
     return false;
   
+  //check the size (+4 for Frame, Length_H, Length_L and CheckSum)
+  if((message->length + 4) > XBEE_TX_BUFFER_SIZE){
+    FreeByteArray(message); //free memory
+    return false;
+  }
+  
   //calculate the check sum
   byte check_sum = CheckSum(message);
   
-  //free Byte Array if contains the Serial Number
-  if(_is_SerialNumber)
-    FreeByteArray(&_barray);
-  
+#ifdef XBEE_USE_FRAME_POOL
+  //store in a slot of the pool (reuse the one of the previous frame if not sent)
+  if(_tx_frame == NULL)
+    _tx_frame = XBeeFramePool::Allocate();
+  if(_tx_frame == NULL){
+    FreeByteArray(message); //free memory
+    return false;
+  }
+  _tx_length = message->length + 4;
+  _tx_frame[0] = FRAME_DELIMITER;
+  _tx_frame[1] = (message->length >> 8) & 0xFF;
+  _tx_frame[2] = message->length & 0xFF;
+  for(int i=0 ; i < message->length ; i++)
+    _tx_frame[3 + i] = message->ptr[i];
+  _tx_frame[_tx_length - 1] = check_sum;
+  FreeByteArray(message); //free memory
+#else
   //store in own Byte Array
   ResizeByteArray(&_barray, 3);
   JoinByteArray(&_barray, message); //add to own byte array
@@ -844,15 +823,73 @@ boolean XBeeMaster::CreateFrame(ByteArray* message){
   //change message
   ResizeByteArray(&_barray, (_barray.length + 1)); //+1 to insert the check sum
   _barray.ptr[0] = FRAME_DELIMITER;
-  _barray.ptr[1] = ((_barray.length - 4) & 0xFF00);
+  _barray.ptr[1] = ((_barray.length - 4) >> 8) & 0xFF;
   _barray.ptr[2] = ((_barray.length - 4) & 0x00FF);
   _barray.ptr[_barray.length - 1] = check_sum;
+#endif
   
   return true;
 }
 
 //-------------------------------------------------------------------------------------------------
 
+// Detect the baudrate of the XBee (API mode first, then command mode)
+//    (returns the baudrate, 0 if not initialized, a job is running or not detected)
+//    NOTE: the connection is left open with the detected baudrate (or with the previous one if not detected)
+//    NOTE: the baudrates are probed by likelihood: current, factory default (9600),
+//          BAUDRATE_XBEE and then from the highest
+//    NOTE: blocks while detecting (up to about 1 second for each baudrate in command mode)
+//    NOTE: reads the identity of the XBee when detected in API mode (see ReadIdentity())
+long XBeeMaster::DetectBaudrate(void){
+  if(!_initialized)
+    return 0;
+  
+  if(_job != XBEE_JOB_NONE)
+    return 0;
+  
+  //order of the probes
+  byte order[8];
+  byte count = 0;
+  byte likely[3];
+  likely[0] = BaudrateIndex(_baudrate);
+  likely[1] = 3; //9600
+  likely[2] = BaudrateIndex(BAUDRATE_XBEE);
+  for(int i=-3 ; i < 8 ; i++){
+    byte bd = ((i < 0) ? likely[i + 3] : (7 - i));
+    if(bd > 7)
+      continue;
+    boolean repeated = false;
+    for(byte j=0 ; j < count ; j++)
+      repeated |= (order[j] == bd);
+    if(!repeated)
+      order[count++] = bd;
+  }
+  
+  long previous = _baudrate;
+  
+  //API mode
+  for(byte i=0 ; i < count ; i++){
+    Reopen(XBEE_BAUDRATES[order[i]]);
+    if(CheckLink(DETECT_TIMEOUT)){
+      ReadIdentity(DETECT_TIMEOUT); //answers in API mode, so safe to read
+      return _baudrate;
+    }
+  }
+  
+  //command mode (the wait for the 'OK' is the guard time before the next probe)
+  delay(GUARD_TIME);
+  for(byte i=0 ; i < count ; i++){
+    Reopen(XBEE_BAUDRATES[order[i]]);
+    if(ProbeCommandMode())
+      return _baudrate;
+  }
+  
+  Reopen(previous);
+  return 0;
+}
+
+//-------------------------------------------------------------------------------------------------
+
 // Destroy the XBeeMaster
 void XBeeMaster::Destroy(void){
   if(!_initialized)
@@ -862,7 +899,32 @@ void XBeeMaster::Destroy(void){
   _xbee->end(); //end communication
   
   FreeByteArray(&_barray);
-  _is_SerialNumber = false; //reset
+  _serial_number = 0; //reset
+  _firmware_version = 0;
+  _hardware_version = 0;
+  _job = XBEE_JOB_NONE; //cancel
+#ifdef XBEE_USE_FRAGMENTS
+  FreeByteArray(&_message_buffer);
+#endif
+#ifdef XBEE_USE_LINK_MONITOR
+  FreeByteArray(&_link_value);
+#endif
+#ifdef XBEE_USE_NODE_QUEUE
+  for(int i=0 ; i < XBEE_MAX_REQUESTS ; i++)
+    FreeByteArray(&_requests[i].frame);
+#endif
+#ifdef XBEE_USE_RETRIES
+  for(int i=0 ; i < XBEE_MAX_REQUESTS ; i++)
+    _requests[i].sent.Clear();
+#endif
+#ifdef XBEE_USE_TX_QUEUE
+  for(int i=0 ; i < XBEE_TX_QUEUE_SIZE ; i++)
+    _queue[i].frame.Clear(); //discard
+#endif
+#ifdef XBEE_USE_FRAME_POOL
+  XBeeFramePool::Release(_tx_frame);
+  XBeeFramePool::Release(_rx_buffer);
+#endif
   _use_computer = false;
   _computer = NULL;
   _initialized = false; //reset
@@ -870,578 +932,4110 @@ void XBeeMaster::Destroy(void){
 
 //-------------------------------------------------------------------------------------------------
 
-// Get the network Channel
-//  (returns 0 if not initialized)
-byte XBeeMaster::GetNetworkChannel(void){
-  if(!_initialized)
-    return 0;
+#ifdef XBEE_USE_LINK_MONITOR
+// Find the link with a node
+//    (returns the index of the link, XBEE_MAX_LINKS if not found)
+byte XBeeMaster::FindLink(byte* address, byte address_length){
+  if(address_length == 0) //broadcast
+    return XBEE_MAX_LINKS;
   
-  return _network_channel;
+  for(byte i=0 ; i < XBEE_MAX_LINKS ; i++){
+    if((_links[i].address_length == address_length) && (memcmp(_links[i].address, address, address_length) == 0))
+      return i;
+  }
+  return XBEE_MAX_LINKS;
 }
 
 //-------------------------------------------------------------------------------------------------
+#endif // XBEE_USE_LINK_MONITOR
 
-// Get the network ID
-//  (returns 0 if not initialized)
-word XBeeMaster::GetNetworkID(void){
-  if(!_initialized)
-    return 0;
-  
-  return _network_id;
+#ifdef XBEE_USE_NODE_QUEUE
+// Find the sleeping node that is the destination of the message (TX request or Remote AT command)
+//    (returns the index of the node, XBEE_MAX_NODES if none)
+byte XBeeMaster::FindDestination(ByteArray* message){
+  byte node = XBEE_MAX_NODES;
+  switch(message->ptr[0]){
+    case API_TX_RESQUEST_64_BIT:
+      if(message->length >= 10)
+        node = FindNode(&message->ptr[2], 8);
+      break;
+    case API_TX_RESQUEST_16_BIT:
+      if(message->length >= 4)
+        node = FindNode(&message->ptr[2], 2);
+      break;
+    case API_REMOTE_AT_COMMAND_REQUEST:
+      if(message->length >= 12){
+        node = FindNode(&message->ptr[2], 8);
+        if(node == XBEE_MAX_NODES)
+          node = FindNode(&message->ptr[10], 2);
+      }
+      break;
+  }
+  return node;
 }
 
-
 //-------------------------------------------------------------------------------------------------
 
-// Get the defined PC baudrate
-long XBeeMaster::GetPCbaudrate(void){
-  return BAUDRATE_PC;
-}
-
-// Get the defined XBee baudrate
-long XBeeMaster::GetXBeebaudrate(void){
-  return BAUDRATE_XBEE;
+// Find a sleeping node
+//    (returns the index of the node, XBEE_MAX_NODES if not found)
+byte XBeeMaster::FindNode(byte* address, byte address_length){
+  for(byte i=0 ; i < XBEE_MAX_NODES ; i++){
+    if((_nodes[i].address_length == address_length) && (memcmp(_nodes[i].address, address, address_length) == 0))
+      return i;
+  }
+  return XBEE_MAX_NODES;
 }
 
 //-------------------------------------------------------------------------------------------------
+#endif // XBEE_USE_NODE_QUEUE
 
-// Get the serial number of the last configured XBee
-char* XBeeMaster::GetSerialNumber(void){
-  if(!_initialized)
-    return "";
-  
-  //check if is a serial number
-  if(!_is_SerialNumber)
-    return "";
-  
-  char* res = ByteArrayToHexString(&_barray);
-  FreeByteArray(&_barray); //to prevent misuse
-  _is_SerialNumber = false; //reset
+// Finish the current job
+//    (returns the given result)
+byte XBeeMaster::FinishJob(byte result){
+  if(result == 1){
+    switch(_job){
+      case XBEE_JOB_CONFIGURE:
+        delay(10);
+        _xbee->flush();
+        _xbee->end();
+        _xbee->begin(_baudrate); //start new connection
+        
+        //cache the serial number
+        _serial_number = 0;
+        for(byte i=0 ; i < 16 ; i++){
+          int digit = HexDigit(_job_serial[i]);
+          if(digit < 0){ //invalid
+            _serial_number = 0;
+            break;
+          }
+          _serial_number = (_serial_number << 4) | digit;
+        }
+        //cache the versions
+        _firmware_version = _job_firmware;
+        _hardware_version = _job_hardware;
+        break;
+      
+      case XBEE_JOB_RESTORE:
+        delay(10);
+        _xbee->flush();
+        _xbee->end();
+        _baudrate = 9600; //default value
+        _xbee->begin(_baudrate); //start new connection
+        break;
+    }
+  }
   
-  return res;
+  XBEE_TRACE(XBEE_TRACE_JOB_END, _job, result, 0);
+  _job = XBEE_JOB_NONE;
+  _job_result = result;
+  return result;
 }
 
 //-------------------------------------------------------------------------------------------------
 
-// Initialize the XBeeMaster
-void XBeeMaster::Initialize(void){
-  if(!_initialized && (_xbee != NULL)){ //must have a serial port assigned
-    _xbee->begin(BAUDRATE_XBEE); //begin transmission
-    InitializeByteArray(&_barray); //initialize Byte Array
-    _is_SerialNumber = false; //set
-    _initialized = true; //set
+#ifdef XBEE_USE_TX_QUEUE
+// Send all the queued frames (by priority, waiting for each one)
+void XBeeMaster::FlushQueue(void){
+  byte index = NextQueued();
+  while(index < XBEE_TX_QUEUE_SIZE){
+    SendQueued(index);
+    index = NextQueued();
   }
 }
 
+//-------------------------------------------------------------------------------------------------
 
-// Initialize the XBeeMaster
-void XBeeMaster::Initialize(HardwareSerial* computer){
-  if(!_initialized && (_xbee != NULL)){ //must have a serial port assigned
-    if((word)computer != (word)_xbee){ //assign only if not used by XBee (because both are pointers, cast to word to compare even for different types)
-      _computer = computer;
-      _computer->begin(BAUDRATE_PC);
-      _use_computer = true;
-    }
-    _xbee->begin(BAUDRATE_XBEE); //begin transmission
-    InitializeByteArray(&_barray); //initialize Byte Array
-    _is_SerialNumber = false; //set
-    _initialized = true; //set
+// Get the priority of a frame by its API identifier
+//    (returns XBEE_PRIORITY_CONTROL for the AT and Remote AT commands, XBEE_PRIORITY_BULK for the fragments
+//      of data and XBEE_PRIORITY_NORMAL for the rest, including the ACK and NACK of the fragments)
+byte XBeeMaster::FramePriority(byte* frame, int length){
+  if(length < 5)
+    return XBEE_PRIORITY_NORMAL;
+  
+  switch(frame[3]){
+    case API_AT_COMMAND:
+    case API_AT_COMMAND_QUEUE:
+    case API_REMOTE_AT_COMMAND_REQUEST:
+      return XBEE_PRIORITY_CONTROL;
+#ifdef XBEE_USE_FRAGMENTS
+    case API_TX_RESQUEST_64_BIT:
+      if((length > 16) && (frame[14] == XBEE_FRAGMENT_MARK) && (frame[15] == XBEE_FRAGMENT_DATA)) //header of 11 bytes
+        return XBEE_PRIORITY_BULK;
+      break;
+    case API_TX_RESQUEST_16_BIT:
+      if((length > 10) && (frame[8] == XBEE_FRAGMENT_MARK) && (frame[9] == XBEE_FRAGMENT_DATA)) //header of 5 bytes
+        return XBEE_PRIORITY_BULK;
+      break;
+#endif
   }
+  return XBEE_PRIORITY_NORMAL;
 }
 
 //-------------------------------------------------------------------------------------------------
+#endif // XBEE_USE_TX_QUEUE
 
-// Listen the response of the XBee Slave
-//   (returns -1 if not initialized, 1 on message listened,
-//      10 on Timeout, 11 on buffer overflow, 12 if frame delimiter not found,
-//      20 if invalid length,
-//      30 if invalid checksum)
-//     NOTE: if 'str' was created using malloc(), 'free_str' must be TRUE
-int XBeeMaster::Listen(char** str, boolean free_str, unsigned long timeout, unsigned long pause_time){
-  //NOTE: with char* the result isn't correctly stored, but with char** is
-
+// Get the 64-bit address of the XBee (serial number - SH and SL)
+//  (returns 0 if not initialized or unknown)
+//    NOTE: cached by ReadIdentity() and by the configuration
+uint64_t XBeeMaster::GetAddress(void){
   if(!_initialized)
-    return -1;
+    return 0;
+  
+  return _serial_number;
+}
 
-  // has to free the string, otherwise will consume memory
-  // verify that: because Listen() uses ByteArrayToHexString(), which uses malloc(), the block/string
-  //                      must be manually freed.
-  if(free_str){
-#ifdef USE_POINTER_LIST
-    Mfree(*str);
-#else
-    free(*str);
-#endif
-  }
 
-#ifdef USE_SOFTWARE_SERIAL
-  _xbee->listen();
-#endif
+// Get the 64-bit address of the XBee in 8 bytes (MSB first, the same as the frames)
+//  (returns FALSE if not initialized or unknown)
+boolean XBeeMaster::GetAddress(byte* address){
+  if(!_initialized || (_serial_number == 0))
+    return false;
   
-  //wait for response or timeout
-  unsigned long start_time;
-  start_time = millis();
-  while(!_xbee->available() && (millis() < (start_time + timeout))){ /* wait */ }
-  if(millis() >= (start_time + timeout))
-    return 10; //should not enter here, because the XBee has its own timeout (API frame 0x97 + status 04)
+  for(byte i=0 ; i < 8 ; i++)
+    address[i] = _serial_number >> (56 - 8 * i);
+  return true;
+}
+
+//-------------------------------------------------------------------------------------------------
+
+// Get the baudrate of the connection with the XBee
+//  (returns 0 if not initialized)
+long XBeeMaster::GetBaudrate(void){
+  if(!_initialized)
+    return 0;
   
-  //insert a pause for the serial buffer fill completely
-  if(pause_time != 0){
-    start_time = millis();
-    while(millis() <= (start_time + pause_time)){ /* wait */ }
-  }
+  return _baudrate;
+}
 
-#define BUFFER_SIZE 150
-  byte buffer[BUFFER_SIZE];
+//-------------------------------------------------------------------------------------------------
+
+#ifdef XBEE_USE_FRAGMENTS
+// Get the received message (the data is moved to 'data' and the source address to 'source_address', which can be NULL)
+//  (returns FALSE if not initialized or no message was received)
+//  NOTE: the message must be taken before the next one can be received
+boolean XBeeMaster::GetMessage(ByteArray* data, ByteArray* source_address){
+  if(!_initialized)
+    return false;
   
-  //read from buffer
-  int i = 0;
-  unsigned int length = 0;
-  while(_xbee->available() && (i < BUFFER_SIZE)){
-    buffer[i] = (byte)_xbee->read();
-    i++;
-    //begin storage if have found start of frame
-    if(buffer[0] != FRAME_DELIMITER){
-      i=0;
-    } else {
-      if(i >= 2){
-        length = (buffer[1] << 8) | buffer[2]; //MSB and LSB
-        //exit loop if has exceeded the length of the frame
-        if(i > (length + 3)) //(+3) for the frame header & (+1) for the CheckSum byte & (-1) because 0 based vector
-          break;
-      }
-    }
-  }
-  //NOTE: i should be equal do (length + 4) because it is increased by 1 after reading the last byte (checksum)
+  if(_message_rx.result != 1)
+    return false;
   
-  //parse message
-  if(length >= BUFFER_SIZE - 3){ //message too long for buffer (100 - 3 bytes for Frame, Length_H and Length_L)
-    return 11;
-  } else if(i == 0){ //frame delimiter not found
-    return 12;
-  } else if(length != (i-4)){ //invalid length - see previous note
-    return 20;
+  //move the data (the buffer is reallocated for the next message)
+  FreeByteArray(data);
+  data->ptr = _message_buffer.ptr;
+  data->length = _message_buffer.length;
+  _message_buffer.ptr = NULL;
+  _message_buffer.length = 0;
+  
+  if(source_address != NULL){
+    ResizeByteArray(source_address, _message_rx.address_length);
+    for(int i=0 ; i < _message_rx.address_length ; i++)
+      source_address->ptr[i] = _message_rx.address[i];
   }
   
-  //use Byte Array because a NULL character (value of 0) returns an invalid string
+  _message_rx.result = 0; //free
+  return true;
+}
+
+//-------------------------------------------------------------------------------------------------
+#endif // XBEE_USE_FRAGMENTS
+
+#ifdef XBEE_USE_LINK_MONITOR
+// Get the statistics of the link with a node
+//    (returns FALSE if not initialized or no link with the node)
+//    NOTE: the links are added by the requests (TX and Remote AT) to the nodes, up to XBEE_MAX_LINKS
+//          (replacing the one without requests for longer)
+//  !!! 'address' in HEX format (64 or 16-bit, the same as the requests)
+boolean XBeeMaster::GetLink(char* address, XBeeLink* link){
+  if(!_initialized)
+    return false;
+  
   ByteArray temp;
   InitializeByteArray(&temp);
-  ResizeByteArray(&temp, length);
-  for(int i=0 ; i < length ; i++)
-    temp.ptr[i] = buffer[3+i];
-#undef BUFFER_SIZE
-  
-  int res = 30;
-  if(CheckSum(&temp) == buffer[length + 3]){ //(+3) for the frame header & (+1) for the CheckSum byte & (-1) because 0 based vector
-    *str = ByteArrayToHexString(&temp);
-    res = 1;
-  }
-
+  HexStringToByteArray(address, &temp);
+  byte index = FindLink(temp.ptr, temp.length);
   FreeByteArray(&temp);
   
-  return res;
+  if(index == XBEE_MAX_LINKS)
+    return false;
+  
+  memcpy(link, &_links[index], sizeof(XBeeLink));
+  return true;
 }
 
 //-------------------------------------------------------------------------------------------------
 
-// Restore the XBee's parameters to their factory settings
-//    (returns 1 when succesful, 0 if not initialized, 13 if timeout of '+++', 14 if other timeout, 23 if number of tries exeeded)
-//    NOTE: assumes that the XBee is currently configured with BAUDRATE_XBEE
-//    NOTE: if an error as occured, the previous transmission cannot be used, so must restart the transmission with a valid baudrate
-byte XBeeMaster::Restore(void){
-  return Restore(BAUDRATE_XBEE);
+// Get the ACK (EA) and CCA (EC) failures of the local XBee
+//    NOTE: the last values read by the link monitor (0 before the first samples)
+void XBeeMaster::GetLinkFailures(word* ack_failures, word* cca_failures){
+  *ack_failures = _link_ack_failures;
+  *cca_failures = _link_cca_failures;
 }
-  
 
-// Restore the XBee's parameters to their factory settings given a baudrate
-//    (returns 1 when succesful, 0 if not initialized, 13 if timeout of '+++', 14 if other timeout, 23 if number of tries exeeded)
-//    NOTE: if an error as occured, the previous transmission cannot be used, so must restart the transmission with a valid baudrate
-byte XBeeMaster::Restore(long baudrate){
+//-------------------------------------------------------------------------------------------------
+#endif // XBEE_USE_LINK_MONITOR
+
+// Get the profile of the XBee (the values of the parameters, to be restored with SetProfile())
+//    (returns 1 when succesful, 0 if not initialized, 3 if a job is running, otherwise the result of the request that failed)
+//    NOTE: the parameters not supported by the firmware (and the ones without value) are skipped
+//    NOTE: BD and AP aren't in the profile, because the API must work with the baudrate of the connection
+//          to set the profile (see ConfigureAsMaster())
+//    NOTE: blocks until all the parameters are read
+byte XBeeMaster::GetProfile(ByteArray* profile){
   if(!_initialized)
     return 0;
   
-  // Procedure:
-  //    1) enter command mode
-  //    2) restore defaults
-  //    3) write changes
-  //    4) exit command mode
-  
-  _xbee->end(); //end previous connection
-  _xbee->begin(baudrate); //begin connection
+  if(_job != XBEE_JOB_NONE)
+    return 3;
   
-#define BUFFER_SIZE 15
-  char c[BUFFER_SIZE]; //add more than 3 to be sure
-  byte count;
-  unsigned long start_time, current_time;
-  byte tries;
-  char* serial_number = "################"; //16 characters
-  //-----------------------------------
-  // 1) ENTER COMMAND MODE
-  tries = 0;
-resend_EnterAT:
-  //check number of tries
-  if(tries > 3)
-    return 23;
-  //reset buffer
-  for(int i=0 ; i < BUFFER_SIZE ; i++)
-    c[i] = EMPTY_CHAR;
-  _xbee->write("+++");
-  tries++;
-  //read response - 'OK\0'
-  count = 0;
-  start_time = millis(); //get the current time
-  current_time = start_time;
-  while((count < 3) && ((current_time - start_time) < AT_TIMEOUT)){
-    if(_xbee->available()){
-      c[count] = _xbee->read();
-      count++;
+  FreeByteArray(profile);
+  ResizeByteArray(profile, XBEE_PROFILE_HEADER);
+  ByteArray value;
+  InitializeByteArray(&value);
+  char command[3];
+  command[2] = '\0';
+  byte res = 1;
+  for(byte i=0 ; i < (sizeof(XBEE_PROFILE_PARAMETERS) - 1) ; i += 2){
+    command[0] = pgm_read_byte(&XBEE_PROFILE_PARAMETERS[i]);
+    command[1] = pgm_read_byte(&XBEE_PROFILE_PARAMETERS[i + 1]);
+    res = WaitRequest(RequestAT(command, NULL, &value));
+    if((res == XBEE_REQUEST_ERROR) || (res == XBEE_REQUEST_INVALID_COMMAND)){ //not supported
+      res = 1;
+      continue;
     }
-    current_time = millis();
+    if(res != 1)
+      break;
+    if((value.length <= 0) || (value.length > 0xFF))
+      continue;
+    
+    //add the record
+    int offset = profile->length;
+    ResizeByteArray(profile, offset + 3 + value.length);
+    profile->ptr[offset] = command[0];
+    profile->ptr[offset + 1] = command[1];
+    profile->ptr[offset + 2] = value.length;
+    for(int j=0 ; j < value.length ; j++)
+      profile->ptr[offset + 3 + j] = value.ptr[j];
   }
-  //check if timeout
-  if((current_time - start_time) >= AT_TIMEOUT)
-    return 13;
-#ifdef XBEE_API_DEBUG
-  //display on computer
-  if(_use_computer){
-    _computer->println(">> +++");
-    for(int i=0 ; i < BUFFER_SIZE ; i++)
-      _computer->print(c[i]);
-    _computer->println();
-  }
-#endif
-  if((c[0] != 0x4F) || (c[1] != 0x4B) || (c[2] != 0x0D)) //not 'OK' resend
-    goto resend_EnterAT;
-  //-----------------------------------
-  // 2) RESTORE DEFAULTS
-  tries = 0;
-resend_RE:
-  //check number of tries
-  if(tries > 3)
-    return 23;
-  //reset buffer
-  for(int i=0 ; i < BUFFER_SIZE ; i++)
-    c[i] = EMPTY_CHAR;
-  _xbee->write("ATRE");
-  _xbee->write(0x0D); //carriage return
-  tries++; //add
-  //read response - 'OK\0'
-  count = 0;
-  start_time = millis(); //get the current time
-  current_time = start_time;
-  while((count < 3) && ((current_time - start_time) < AT_TIMEOUT)){
-    if(_xbee->available()){
-      c[count] = _xbee->read();
-      count++;
-    }
-    current_time = millis();
+  FreeByteArray(&value);
+  if(res != 1){
+    FreeByteArray(profile);
+    return ((res == 0) ? XBEE_REQUEST_ERROR : res); //0 if no free request
   }
-  //check if timeout
-  if((current_time - start_time) >= AT_TIMEOUT)
-    return 14;
-#ifdef XBEE_API_DEBUG
-  //display on computer
-  if(_use_computer){
-    _computer->println(">> ATRE");
-    for(int i=0 ; i < BUFFER_SIZE ; i++)
-      _computer->print(c[i]);
-    _computer->println();
-  }
-#endif
-  if((c[0] != 0x4F) || (c[1] != 0x4B) || (c[2] != 0x0D)) //not 'OK' resend
-    goto resend_RE;
-  //-----------------------------------
-  // 3) WRITE CHANGES TO XBEE
-  tries = 0;
-resend_WR:
-  if(tries > 3)
-    return 23;
-  //reset buffer
-  for(int i=0 ; i < BUFFER_SIZE ; i++)
-    c[i] = EMPTY_CHAR;
-  _xbee->write("ATWR");
-  _xbee->write(0x0D); //carriage return
-  tries++; //add
-  //read response - 'OK\0'
-  count = 0;
-  start_time = millis(); //get the current time
-  current_time = start_time;
-  while((count < 3) && ((current_time - start_time) < AT_TIMEOUT)){
-    if(_xbee->available()){
-      c[count] = _xbee->read();
-      count++;
+  
+  //header and checksum
+  word length = profile->length - XBEE_PROFILE_HEADER;
+  profile->ptr[0] = XBEE_PROFILE_MARK;
+  profile->ptr[1] = XBEE_PROFILE_VERSION;
+  profile->ptr[2] = length >> 8;
+  profile->ptr[3] = length & 0xFF;
+  ResizeByteArray(profile, profile->length + 1);
+  profile->ptr[profile->length - 1] = CheckSum(&profile->ptr[XBEE_PROFILE_HEADER], length);
+  
+  return 1;
+}
+
+//-------------------------------------------------------------------------------------------------
+
+// Get the network Channel
+//  (returns 0 if not initialized)
+byte XBeeMaster::GetNetworkChannel(void){
+  if(!_initialized)
+    return 0;
+  
+  return _network_channel;
+}
+
+//-------------------------------------------------------------------------------------------------
+
+// Get the network ID
+//  (returns 0 if not initialized)
+word XBeeMaster::GetNetworkID(void){
+  if(!_initialized)
+    return 0;
+  
+  return _network_id;
+}
+
+
+//-------------------------------------------------------------------------------------------------
+
+// Get the defined PC baudrate
+long XBeeMaster::GetPCbaudrate(void){
+  return BAUDRATE_PC;
+}
+
+// Get the defined XBee baudrate
+long XBeeMaster::GetXBeebaudrate(void){
+  return BAUDRATE_XBEE;
+}
+
+//-------------------------------------------------------------------------------------------------
+
+#ifdef XBEE_USE_PACING
+// Get the number of sent frames waiting for the response
+//  (returns 0 if not initialized)
+byte XBeeMaster::GetOutstandingFrames(void){
+  if(!_initialized)
+    return 0;
+  
+  byte count = 0;
+  for(byte i=0 ; i < XBEE_TX_WINDOW ; i++){
+    if(_tx_window[i].frame_id != 0)
+      count++;
+  }
+  return count;
+}
+
+//-------------------------------------------------------------------------------------------------
+#endif // XBEE_USE_PACING
+
+#ifdef XBEE_USE_TX_QUEUE
+// Get the number of frames waiting in the queue to be sent
+//  (returns 0 if not initialized)
+byte XBeeMaster::GetQueuedFrames(void){
+  if(!_initialized)
+    return 0;
+  
+  byte count = 0;
+  for(byte i=0 ; i < XBEE_TX_QUEUE_SIZE ; i++){
+    if(_queue[i].frame.GetDataLength() != 0)
+      count++;
+  }
+  return count;
+}
+
+//-------------------------------------------------------------------------------------------------
+#endif // XBEE_USE_TX_QUEUE
+
+// Get the firmware version of the XBee (VR)
+//  (returns 0 if not initialized or unknown)
+//    NOTE: cached by ReadIdentity() and by the configuration
+word XBeeMaster::GetFirmwareVersion(void){
+  if(!_initialized)
+    return 0;
+  
+  return _firmware_version;
+}
+
+//-------------------------------------------------------------------------------------------------
+
+// Get the time of arrival of the last frame received (e.g. in a frame handler or after Listen())
+//  (returns micros() when the first byte of the frame was read, 0 if not initialized)
+//    NOTE: the bytes are read by Poll(), Process() and Listen(), so call them often for accurate times
+//    NOTE: micros() wraps after about 71 minutes, so compare the times only by their difference
+//          (e.g. (GetFrameTime() - sent_time) < limit)
+unsigned long XBeeMaster::GetFrameTime(void){
+  if(!_initialized)
+    return 0;
+  
+  return _rx_time;
+}
+
+//-------------------------------------------------------------------------------------------------
+
+// Get the hardware version of the XBee (HV)
+//  (returns 0 if not initialized or unknown)
+//    NOTE: cached by ReadIdentity() and by the configuration
+word XBeeMaster::GetHardwareVersion(void){
+  if(!_initialized)
+    return 0;
+  
+  return _hardware_version;
+}
+
+//-------------------------------------------------------------------------------------------------
+
+// Get the serial number of the XBee in HEX format
+//    (returns "" if not initialized or unknown)
+//    NOTE: made from the cached value, so it can be called many times (see GetAddress())
+char* XBeeMaster::GetSerialNumber(void){
+  if(!_initialized)
+    return "";
+  
+  ByteArray temp;
+  InitializeByteArray(&temp);
+  ResizeByteArray(&temp, 8);
+  if(!GetAddress(temp.ptr)){
+    FreeByteArray(&temp);
+    return "";
+  }
+  
+  char* res = ByteArrayToHexString(&temp);
+  FreeByteArray(&temp);
+  
+  return res;
+}
+
+//-------------------------------------------------------------------------------------------------
+
+#ifdef XBEE_USE_NODE_QUEUE
+// Get the period between the wake ups of a sleeping node (learned from the received frames)
+//    (returns the period in milliseconds, 0 if not initialized, unknown or not a sleeping node)
+//  !!! 'address' in HEX format
+unsigned long XBeeMaster::GetWakePeriod(char* address){
+  if(!_initialized)
+    return 0;
+  
+  ByteArray temp;
+  InitializeByteArray(&temp);
+  HexStringToByteArray(address, &temp);
+  byte node = FindNode(temp.ptr, temp.length);
+  FreeByteArray(&temp);
+  
+  if(node == XBEE_MAX_NODES)
+    return 0;
+  
+  return _nodes[node].period;
+}
+
+//-------------------------------------------------------------------------------------------------
+#endif // XBEE_USE_NODE_QUEUE
+
+#ifdef XBEE_USE_FRAGMENTS
+// Handle a received fragment (the RF data of the frame)
+//    NOTE: answers the last fragment of a message with the ACK, or with the NACK of the missing fragments
+void XBeeMaster::HandleFragment(byte* address, byte address_length, byte* payload, int length){
+  byte kind = payload[1];
+  byte message_id = payload[2];
+  byte index = payload[3];
+  byte count = payload[4];
+  byte* data = &payload[XBEE_FRAGMENT_HEADER];
+  length -= XBEE_FRAGMENT_HEADER;
+  
+  //response to the sent message
+  if((kind == XBEE_FRAGMENT_ACK) || (kind == XBEE_FRAGMENT_NACK)){
+    XBeeLongMessage* message = &_message_tx;
+    if((message->result != XBEE_REQUEST_PENDING) || (message->message_id != message_id) ||
+        (message->address_length != address_length) || (memcmp(message->address, address, address_length) != 0))
+      return;
+    
+    if(kind == XBEE_FRAGMENT_ACK){
+      message->result = 1;
+    } else {
+      //send the missing fragments again (and the last one to get the next response)
+      for(int i=0 ; (i < length) && (i < (XBEE_FRAGMENT_MAX / 8)) ; i++)
+        message->bitmap[i] = data[i];
+      FRAGMENT_SET(message->bitmap, message->count - 1);
+      message->next = 0;
+      message->tries = 0;
+      message->time = millis() - FRAGMENT_INTERVAL;
+    }
+    return;
+  }
+  
+  if((kind != XBEE_FRAGMENT_DATA) || (count == 0) || (count > XBEE_FRAGMENT_MAX) || (index >= count) || (length > XBEE_FRAGMENT_SIZE))
+    return;
+  if((index < (count - 1)) && (length != XBEE_FRAGMENT_SIZE)) //only the last fragment can be shorter
+    return;
+  
+  XBeeLongMessage* message = &_message_rx;
+  boolean same = ((message->result != 0) && (message->message_id == message_id) && (message->count == count) &&
+      (message->address_length == address_length) && (memcmp(message->address, address, address_length) == 0));
+  if(!same){
+    if(message->result != 0) //busy with other message (or not taken yet)
+      return;
+    
+    //begin the new message
+    ResizeByteArray(message->data, count * XBEE_FRAGMENT_SIZE);
+    if(message->data->ptr == NULL) //not enough memory
+      return;
+    message->result = XBEE_REQUEST_PENDING;
+    message->message_id = message_id;
+    message->count = count;
+    for(int i=0 ; i < address_length ; i++)
+      message->address[i] = address[i];
+    message->address_length = address_length;
+    message->length = 0;
+    for(int i=0 ; i < (XBEE_FRAGMENT_MAX / 8) ; i++)
+      message->bitmap[i] = 0;
+  }
+  
+  if(message->result == 1){ //already received (the ACK was lost)
+    if(index == (count - 1))
+      SendFragment(address, address_length, XBEE_FRAGMENT_ACK, message_id, index, count, NULL, 0);
+    return;
+  }
+  
+  message->time = millis();
+  if(!FRAGMENT_IS_SET(message->bitmap, index)){
+    int offset = index * XBEE_FRAGMENT_SIZE;
+    for(int i=0 ; i < length ; i++)
+      message->data->ptr[offset + i] = data[i];
+    FRAGMENT_SET(message->bitmap, index);
+    if(index == (count - 1))
+      message->length = offset + length;
+  }
+  
+  //get the missing fragments
+  byte missing[XBEE_FRAGMENT_MAX / 8];
+  boolean complete = true;
+  for(int i=0 ; i < (XBEE_FRAGMENT_MAX / 8) ; i++)
+    missing[i] = 0;
+  for(byte i=0 ; i < count ; i++){
+    if(!FRAGMENT_IS_SET(message->bitmap, i)){
+      FRAGMENT_SET(missing, i);
+      complete = false;
+    }
+  }
+  
+  if(complete){
+    ResizeByteArray(message->data, message->length);
+    message->result = 1;
+    SendFragment(address, address_length, XBEE_FRAGMENT_ACK, message_id, index, count, NULL, 0);
+  } else if(index == (count - 1)){
+    SendFragment(address, address_length, XBEE_FRAGMENT_NACK, message_id, index, count, missing, ((count + 7) >> 3));
+  }
+}
+
+//-------------------------------------------------------------------------------------------------
+#endif // XBEE_USE_FRAGMENTS
+
+// Handle a received frame (without the header and the checksum)
+//    NOTE: reports the sent frames to the Send Callback and completes the matching request
+void XBeeMaster::HandleFrame(byte* frame, int length){
+  if(length <= 0)
+    return;
+  
+  XBEE_TRACE(XBEE_TRACE_FRAME_RX, frame[0], ((length > 1) ? frame[1] : 0), length);
+  XBEE_STATS_ADD(frames_received[StatsIndex(frame[0])]);
+  
+  //dispatch to the handler of the API identifier
+  if(((frame[0] & 0xE0) == 0x80) && (_handlers[frame[0] & 0x1F] != NULL))
+    _handlers[frame[0] & 0x1F](frame, length);
+  
+  if(_scan_pans != NULL)
+    HandleScan(frame, length);
+  
+  byte type; //type of the request that waits for the frame
+  byte status = 0;
+  int offset; //begin of the data
+  int address_length = 0;
+  switch(frame[0]){
+    case API_AT_COMMAND_RESPONSE:
+      if(length < 5)
+        return;
+      type = API_AT_COMMAND;
+      status = frame[4];
+      offset = 5;
+      break;
+    case API_REMOTE_COMMAND_RESPONSE:
+      if(length < 15)
+        return;
+      type = API_REMOTE_AT_COMMAND_REQUEST;
+      status = frame[14];
+      offset = 15;
+      break;
+    case API_TX_STATUS:
+      if(length < 3)
+        return;
+      type = API_TX_RESQUEST_64_BIT; //same for 16-bit
+      status = frame[2];
+      offset = 3;
+      break;
+    case API_RX_64_BIT:
+    case API_RX_64_BIT_IO:
+      if(length < 11)
+        return;
+      type = API_RX_64_BIT;
+      address_length = 8;
+      offset = 11; //after the RSSI and the options
+      break;
+    case API_RX_16_BIT:
+    case API_RX_16_BIT_IO:
+      if(length < 5)
+        return;
+      type = API_RX_16_BIT;
+      address_length = 2;
+      offset = 5; //after the RSSI and the options
+      break;
+    default:
+      return;
+  }
+  
+#ifdef XBEE_USE_PACING
+  if(address_length == 0)
+    ReleaseFrame(frame[0], frame[1]);
+#endif
+  
+  //report the completion of a sent frame
+  if((address_length == 0) && (_send_callback != NULL))
+    _send_callback(frame[1], status);
+  
+#ifdef XBEE_USE_NODE_QUEUE
+  //the source is awake
+  if(address_length > 0){
+    WakeNode(&frame[1], address_length);
+  } else if(frame[0] == API_REMOTE_COMMAND_RESPONSE){
+    WakeNode(&frame[2], 8);
+    WakeNode(&frame[10], 2);
+  }
+#endif
+  
+#ifdef XBEE_USE_LINK_MONITOR
+  //RSSI of the frame received from a node with a link
+  if(address_length > 0){
+    byte link = FindLink(&frame[1], address_length);
+    if(link < XBEE_MAX_LINKS)
+      _links[link].rssi = LINK_SMOOTH(_links[link].rssi, frame[1 + address_length]);
+  }
+#endif
+  
+#ifdef XBEE_USE_FRAGMENTS
+  //fragment of a message
+  if(((frame[0] == API_RX_64_BIT) || (frame[0] == API_RX_16_BIT)) && ((length - offset) >= XBEE_FRAGMENT_HEADER) && (frame[offset] == XBEE_FRAGMENT_MARK)){
+    HandleFragment(&frame[1], address_length, &frame[offset], length - offset);
+    return;
+  }
+#endif
+  
+  //complete the request
+  for(byte i=0 ; i < XBEE_MAX_REQUESTS ; i++){
+    XBeeRequest* request = &_requests[i];
+    if(request->result != XBEE_REQUEST_PENDING)
+      continue;
+#ifdef XBEE_USE_NODE_QUEUE
+    if(request->frame.length > 0) //not sent yet
+      continue;
+#endif
+    
+    if(address_length == 0){ //match by frame ID
+      byte request_type = request->type;
+      if(request_type == API_TX_RESQUEST_16_BIT)
+        request_type = API_TX_RESQUEST_64_BIT;
+      else if(request_type == API_AT_COMMAND_QUEUE)
+        request_type = API_AT_COMMAND;
+      if((request_type == type) && (request->frame_id == frame[1])){
+        CompleteRequest(i, XBeeMessages::ResponseResult(frame[0], status), &frame[offset], length - offset);
+        return;
+      }
+#ifdef XBEE_USE_RETRIES
+      //late response of the previous attempt (the failures are duplicates of the one already handled)
+      if((request_type == type) && (request->attempt > 1) && (request->previous_frame_id == frame[1])){
+        if(XBeeMessages::ResponseResult(frame[0], status) == 1)
+          CompleteRequest(i, 1, &frame[offset], length - offset);
+        return;
+      }
+#endif
+    } else if((request->type == type) && (memcmp(request->address, &frame[1], address_length) == 0)){ //match by source address
+      CompleteRequest(i, 1, &frame[offset], length - offset);
+      return;
+    }
+  }
+}
+
+//-------------------------------------------------------------------------------------------------
+
+// Handle a response of the active scan (one for each PAN found and an empty one at the end)
+void XBeeMaster::HandleScan(byte* frame, int length){
+  if((frame[0] != API_AT_COMMAND_RESPONSE) || (length < 5) || (frame[2] != 'A') || (frame[3] != 'S'))
+    return;
+  
+  //PAN descriptor: coordinator address (2 or 8 bytes), PAN ID (2 bytes), address mode (2 or 3) and channel
+  byte* data = &frame[5];
+  int data_length = length - 5;
+  byte channel = 0;
+  if(data_length == 0)
+    _scan_done = true;
+  else if((data_length > 5) && (data[4] == 0x02))
+    channel = data[5];
+  else if((data_length > 11) && (data[10] == 0x03))
+    channel = data[11];
+  
+  if((channel >= 0x0B) && (channel <= 0x1A) && (_scan_pans[channel - 0x0B] < 0xFF))
+    _scan_pans[channel - 0x0B]++;
+}
+
+//-------------------------------------------------------------------------------------------------
+
+#ifdef XBEE_USE_PACING
+// Check if the frame has a response (API identifier with a frame ID different of 0)
+boolean XBeeMaster::HasResponse(byte* frame, int length){
+  if(length < 5)
+    return false;
+  
+  switch(frame[3]){
+    case API_AT_COMMAND:
+    case API_AT_COMMAND_QUEUE:
+    case API_REMOTE_AT_COMMAND_REQUEST:
+    case API_TX_RESQUEST_64_BIT:
+    case API_TX_RESQUEST_16_BIT:
+      return (frame[4] != 0);
+  }
+  return false;
+}
+
+//-------------------------------------------------------------------------------------------------
+
+// Check if a frame can be sent without waiting (see WaitToSend())
+boolean XBeeMaster::IsReadyToSend(byte* frame, int length){
+  if(!HasResponse(frame, length))
+    return ((long)(micros() - _tx_ready) >= 0);
+  
+  boolean ready = false;
+  unsigned long current_time = micros();
+  for(byte i=0 ; i < XBEE_TX_WINDOW ; i++){
+    if((_tx_window[i].frame_id != 0) && ((current_time - _tx_window[i].time) >= (PACING_EXPIRE * 1000UL)))
+      _tx_window[i].frame_id = 0; //response lost
+    if(_tx_window[i].frame_id == 0)
+      ready = true;
+  }
+  return ready;
+}
+
+//-------------------------------------------------------------------------------------------------
+#endif // XBEE_USE_PACING
+
+#ifdef XBEE_API_STATS
+// Get a snapshot of the statistics
+//  (returns FALSE if not initialized)
+boolean XBeeMaster::GetStats(XBeeStats* stats){
+  if(!_initialized)
+    return false;
+  
+  memcpy(stats, &_stats, sizeof(XBeeStats));
+  return true;
+}
+
+//-------------------------------------------------------------------------------------------------
+#endif // XBEE_API_STATS
+
+// Get the value of a HEX digit
+//    (returns -1 if invalid)
+int XBeeMaster::HexDigit(char c){
+  if((c >= '0') && (c <= '9'))
+    return (c - '0');
+  if((c >= 'A') && (c <= 'F'))
+    return (c - 'A' + 10);
+  if((c >= 'a') && (c <= 'f'))
+    return (c - 'a' + 10);
+  return -1;
+}
+
+//-------------------------------------------------------------------------------------------------
+
+// Initialize the XBeeMaster
+//    NOTE: doesn't read the identity of the XBee, because the mode is still unknown (see ReadIdentity() and DetectBaudrate())
+void XBeeMaster::Initialize(void){
+  if(!_initialized && (_xbee != NULL)){ //must have a serial port assigned
+    Setup();
+  }
+}
+
+
+// Initialize the XBeeMaster
+void XBeeMaster::Initialize(HardwareSerial* computer){
+  if(!_initialized && (_xbee != NULL)){ //must have a serial port assigned
+    if((word)computer != (word)_xbee){ //assign only if not used by XBee (because both are pointers, cast to word to compare even for different types)
+      _computer = computer;
+      _computer->begin(BAUDRATE_PC);
+      _use_computer = true;
+    }
+    Setup();
+  }
+}
+
+//-------------------------------------------------------------------------------------------------
+
+// Check if a job is running
+//  (returns FALSE if not initialized)
+boolean XBeeMaster::IsBusy(void){
+  if(!_initialized)
+    return false;
+  
+  return (_job != XBEE_JOB_NONE);
+}
+
+//-------------------------------------------------------------------------------------------------
+
+#ifdef XBEE_USE_TX_QUEUE
+// Check if a frame of a priority is waiting in the queue
+boolean XBeeMaster::IsQueued(byte priority){
+  for(byte i=0 ; i < XBEE_TX_QUEUE_SIZE ; i++){
+    if((_queue[i].frame.GetDataLength() != 0) && (_queue[i].priority == priority))
+      return true;
+  }
+  return false;
+}
+
+//-------------------------------------------------------------------------------------------------
+
+// Check if a frame can be written without waiting (the previous frame left the serial port and, with XBEE_USE_PACING, see IsReadyToSend())
+boolean XBeeMaster::IsWritable(byte* frame, int length){
+  if((long)(micros() - _queue_free) < 0)
+    return false;
+  
+#ifdef XBEE_USE_PACING
+  return IsReadyToSend(frame, length);
+#else
+  (void)frame; //only the pacing checks the frame
+  (void)length;
+  return true;
+#endif
+}
+
+//-------------------------------------------------------------------------------------------------
+#endif // XBEE_USE_TX_QUEUE
+
+// Listen the response of the XBee Slave
+//   (returns -1 if not initialized, 1 on message listened,
+//      10 on Timeout, 11 on buffer overflow, 12 if frame delimiter not found,
+//      20 if invalid length,
+//      30 if invalid checksum)
+//     NOTE: if 'str' was created using malloc(), 'free_str' must be TRUE
+int XBeeMaster::Listen(char** str, boolean free_str, unsigned long timeout, unsigned long pause_time){
+  //NOTE: with char* the result isn't correctly stored, but with char** is
+
+  if(!_initialized)
+    return -1;
+
+  // has to free the string, otherwise will consume memory
+  // verify that: because Listen() uses ByteArrayToHexString(), which uses malloc(), the block/string
+  //                      must be manually freed.
+  if(free_str){
+#ifdef USE_POINTER_LIST
+    Mfree(*str);
+#else
+    free(*str);
+#endif
+  }
+  
+  XBeeFrame frame;
+  int res = Listen(&frame, timeout, pause_time);
+  if(res == 1){
+    //use Byte Array because a NULL character (value of 0) returns an invalid string
+    ByteArray temp; //points to the data of the frame, DO NOT free
+    temp.ptr = frame.GetData();
+    temp.length = frame.GetDataLength();
+    *str = ByteArrayToHexString(&temp);
+  }
+  
+  return res;
+}
+
+//------------------------------------------
+
+// Listen to the XBee (the frame is stored in 'frame')
+//  (returns -1 if not initialized, 1 if successful, 10 on timeout, 11 if the frame is too long,
+//      12 if no frame delimiter, 20 if invalid length and 30 if invalid checksum)
+//    NOTE: the frame is received straight in the storage of 'frame' (emptied if not successful)
+//    NOTE: with XBEE_USE_TX_QUEUE, the queued frames are sent first
+//    NOTE: the rest of a frame too long is skipped by the next call (it searches for the frame delimiter)
+//    NOTE: the time of arrival of the frame is given by GetFrameTime()
+int XBeeMaster::Listen(XBeeFrame* frame, unsigned long timeout, unsigned long pause_time){
+  if(!_initialized)
+    return -1;
+  
+  frame->Clear();
+#ifdef XBEE_USE_TX_QUEUE
+  FlushQueue(); //send the queued frames before waiting for the response
+#endif
+
+#ifdef USE_SOFTWARE_SERIAL
+  _xbee->listen();
+#endif
+  
+  //wait for response or timeout (by the elapsed time, so it works when millis() wraps)
+  unsigned long start_time;
+  start_time = millis();
+  while(!_xbee->available() && ((millis() - start_time) < timeout)){ /* wait */ }
+  if(!_xbee->available()){
+    XBEE_STATS_ADD(timeouts);
+    return 10; //should not enter here, because the XBee has its own timeout (API frame 0x97 + status 04)
+  }
+  _rx_time = micros(); //arrival of the first byte
+  
+  //insert a pause for the serial buffer fill completely
+  if(pause_time != 0){
+    start_time = millis();
+    while((millis() - start_time) <= pause_time){ /* wait */ }
+  }
+
+#define BUFFER_SIZE XBEE_RX_BUFFER_SIZE
+  //read from buffer (the storage grows when the length is known)
+  byte* buffer = frame->_ptr;
+  int i = 0;
+  unsigned int length = 0;
+  while(_xbee->available() && (i < BUFFER_SIZE)){
+    buffer[i] = (byte)_xbee->read();
+    i++;
+    //begin storage if have found start of frame
+    if(buffer[0] != FRAME_DELIMITER){
+      i=0;
+    } else if(i == 3){
+      length = (buffer[1] << 8) | buffer[2]; //MSB and LSB
+      if(((length + 4) > BUFFER_SIZE) || !frame->Reserve(length))
+        break; //too long
+      buffer = frame->_ptr; //might have moved
+    } else if(i > (length + 3)){ //exit loop if has exceeded the length of the frame
+      break; //(+3) for the frame header & (+1) for the CheckSum byte & (-1) because 0 based vector
+    }
+  }
+  //NOTE: i should be equal do (length + 4) because it is increased by 1 after reading the last byte (checksum)
+#ifdef XBEE_API_CAPTURE
+  if(i > 0)
+    Capture(true, buffer, i);
+#endif
+  
+  //parse message
+  int res = 30;
+  if((length + 4) > BUFFER_SIZE){ //message too long for buffer (+4 for Frame, Length_H, Length_L and CheckSum)
+    res = 11;
+    XBEE_STATS_ADD(overflows);
+  } else if(i == 0){ //frame delimiter not found
+    res = 12;
+  } else if(length != (i-4)){ //invalid length - see previous note
+    res = 20;
+    XBEE_STATS_ADD(length_errors);
+  } else if(CheckSum(&buffer[3], length) == buffer[length + 3]){ //(+3) for the frame header & (+1) for the CheckSum byte & (-1) because 0 based vector
+    frame->_length = length;
+    frame->_sum = 0xFF - buffer[length + 3];
+    res = 1;
+    
+    HandleFrame(&buffer[3], length); //report the completion of a sent frame
+  } else {
+    XBEE_STATS_ADD(checksum_errors);
+  }
+#undef BUFFER_SIZE
+  
+  if(res != 1)
+    frame->Clear();
+  
+  return res;
+}
+
+//-------------------------------------------------------------------------------------------------
+
+#ifdef XBEE_USE_LINK_MONITOR
+// Get the timeout of the requests to a node (by the round trip time of the link, like RTO of TCP)
+//    (returns LISTEN_TIMEOUT if no link with the node or no response yet)
+//    NOTE: doubled for each consecutive request without response (up to LINK_BACKOFF_MAX times)
+unsigned long XBeeMaster::LinkTimeout(byte* address, byte address_length){
+  byte index = FindLink(address, address_length);
+  if((index == XBEE_MAX_LINKS) || (_links[index].successes == 0))
+    return LISTEN_TIMEOUT;
+  
+  XBeeLink* link = &_links[index];
+  unsigned long timeout = link->srtt + 4 * link->rttvar;
+  if(timeout < LINK_TIMEOUT_MIN)
+    timeout = LINK_TIMEOUT_MIN;
+  timeout <<= link->failures;
+  if(timeout > LINK_TIMEOUT_MAX)
+    timeout = LINK_TIMEOUT_MAX;
+  
+  return timeout;
+}
+
+//-------------------------------------------------------------------------------------------------
+#endif // XBEE_USE_LINK_MONITOR
+
+#ifdef XBEE_USE_FRAGMENTS
+// Get the result of the sent message
+//    (returns 1 when received by the destination, 0 if not initialized or no message, XBEE_REQUEST_PENDING while sending,
+//      XBEE_REQUEST_TIMEOUT if the destination didn't answer)
+//    NOTE: the message is released when the result is returned
+byte XBeeMaster::MessageStatus(void){
+  if(!_initialized)
+    return 0;
+  
+  byte res = _message_tx.result;
+  if(res != XBEE_REQUEST_PENDING)
+    _message_tx.result = 0; //free
+  
+  return res;
+}
+
+//-------------------------------------------------------------------------------------------------
+#endif // XBEE_USE_FRAGMENTS
+
+// Negotiate the highest baudrate that works with the XBee (in API mode)
+//    (returns 1 when succesful, 0 if not initialized, 3 if a job is running, 14 if no response, 33 if invalid user Baudrate)
+//    NOTE: tries from 'max_baudrate' down to the current baudrate, checking each one with a round trip
+//          (the current baudrate is kept if none works, or if 'max_baudrate' isn't higher, so it's never lowered)
+//    NOTE: if 'write' is TRUE, the new baudrate is also written in the XBee (WR)
+//    NOTE: blocks while negotiating (up to NEGOTIATE_TIMEOUT for each request)
+//    NOTE: on 14, the XBee might be left with a baudrate that doesn't work (until reset, unless written)
+byte XBeeMaster::NegotiateBaudrate(long max_baudrate, boolean write){
+  if(!_initialized)
+    return 0;
+  
+  if(_job != XBEE_JOB_NONE)
+    return 3;
+  
+  int max_bd = BaudrateIndex(max_baudrate);
+  if(max_bd == 0xFF)
+    return 33; //invalid baudrate
+  
+  int current_bd = BaudrateIndex(_baudrate);
+  if(current_bd == 0xFF) //not one of the XBee (tries all of them)
+    current_bd = -1;
+  if(max_bd <= current_bd) //already as fast
+    return 1;
+  
+  //check the current link
+  if(!CheckLink(NEGOTIATE_TIMEOUT))
+    return 14;
+  
+  for(int bd = max_bd ; bd > current_bd ; bd--){
+    if(ChangeBaudrate(bd))
+      break;
+    if(!CheckLink(NEGOTIATE_TIMEOUT))
+      return 14; //the XBee didn't return to the previous baudrate
+  }
+  
+  if(write && (WaitRequest(RequestAT(WR, NULL, NULL, NEGOTIATE_TIMEOUT)) != 1))
+    return 14;
+  
+  return 1;
+}
+
+//-------------------------------------------------------------------------------------------------
+
+// Get the parameter of the configuration that follows the given step
+//    (returns XBEE_STEP_WR after the last parameter, or XBEE_STEP_SH if the differential configuration set none)
+//    NOTE: the steps of the parameters are in sequence (XBEE_STEP_ID to XBEE_STEP_AP)
+byte XBeeMaster::NextConfigureStep(byte step){
+  byte next = ((step == XBEE_STEP_READ) ? XBEE_STEP_ID : (step + 1));
+  for( ; next <= XBEE_STEP_AP ; next++){
+    if((next == XBEE_STEP_MY) && _job_master) //16-bit address for slave only
+      continue;
+    if(!_job_differential || (_job_diff & (1 << next)))
+      return next;
+  }
+  
+  if(_job_differential && (_job_diff == 0)) //nothing to write
+    return XBEE_STEP_SH;
+  return XBEE_STEP_WR;
+}
+
+//-------------------------------------------------------------------------------------------------
+
+// Get the next frame ID (0 disables the response)
+byte XBeeMaster::NextFrameID(void){
+  _frame_id++;
+  if(_frame_id == 0)
+    _frame_id = 1;
+  return _frame_id;
+}
+
+//-------------------------------------------------------------------------------------------------
+
+// Get the step that follows the current one in the job
+byte XBeeMaster::NextJobStep(void){
+  switch(_job_step){
+    case XBEE_STEP_ENTER:
+      if(_job == XBEE_JOB_PINS)
+        return XBEE_STEP_PIN;
+      else if(_job == XBEE_JOB_RESTORE)
+        return XBEE_STEP_RE;
+      return (_job_differential ? XBEE_STEP_READ : XBEE_STEP_ID);
+    case XBEE_STEP_READ:
+    case XBEE_STEP_ID:
+    case XBEE_STEP_CH:
+    case XBEE_STEP_MY:
+    case XBEE_STEP_BD:
+    case XBEE_STEP_AP: return NextConfigureStep(_job_step);
+    case XBEE_STEP_PIN:
+      _job_pin++;
+      if(_job_pin < _job_num_pins)
+        return XBEE_STEP_PIN;
+      return XBEE_STEP_WR;
+    case XBEE_STEP_RE: return XBEE_STEP_WR;
+    case XBEE_STEP_WR: return ((_job == XBEE_JOB_CONFIGURE) ? XBEE_STEP_SH : XBEE_STEP_EXIT);
+    case XBEE_STEP_SH: return XBEE_STEP_SL;
+    case XBEE_STEP_SL: return XBEE_STEP_VR;
+    case XBEE_STEP_VR: return XBEE_STEP_HV;
+  }
+  return XBEE_STEP_EXIT;
+}
+
+//-------------------------------------------------------------------------------------------------
+
+#ifdef XBEE_USE_TX_QUEUE
+// Select the next queued frame to send
+//    (returns the index of the frame, XBEE_TX_QUEUE_SIZE if none)
+//    NOTE: the highest priority goes first (the oldest frame in each priority), but a priority passed over
+//          QUEUE_STARVATION times goes before the others
+byte XBeeMaster::NextQueued(void){
+  byte index = XBEE_TX_QUEUE_SIZE;
+  byte rank = 0; //0 if starving, otherwise (priority + 1)
+  for(byte i=0 ; i < XBEE_TX_QUEUE_SIZE ; i++){
+    XBeeQueuedFrame* queued = &_queue[i];
+    if(queued->frame.GetDataLength() == 0)
+      continue;
+    
+    byte current = ((_queue_passed[queued->priority] >= QUEUE_STARVATION) ? 0 : (queued->priority + 1));
+    if((index == XBEE_TX_QUEUE_SIZE) || (current < rank) ||
+       ((current == rank) && ((word)(_queue_order - queued->order) > (word)(_queue_order - _queue[index].order)))){ //older
+      index = i;
+      rank = current;
+    }
+  }
+  return index;
+}
+
+//-------------------------------------------------------------------------------------------------
+#endif // XBEE_USE_TX_QUEUE
+
+// Parse a received byte
+//    (returns TRUE if a valid frame was completed and handled)
+//    NOTE: the bytes before the frame delimiter are ignored
+boolean XBeeMaster::ParseByte(byte b){
+  //begin storage if have found start of frame
+  if((_rx_count == 0) && (b != FRAME_DELIMITER))
+    return false;
+  if(_rx_count == 0)
+    _rx_time = micros(); //arrival of the frame (see GetFrameTime())
+#ifdef XBEE_USE_FRAME_POOL
+  if(_rx_buffer == NULL)
+    _rx_buffer = XBeeFramePool::Allocate();
+  if(_rx_buffer == NULL) //no buffer available, drop the frame
+    return false;
+#endif
+  boolean handled = false;
+  _rx_buffer[_rx_count] = b;
+  _rx_count++;
+  
+  if(_rx_count == 3){
+    _rx_length = (_rx_buffer[1] << 8) | _rx_buffer[2]; //MSB and LSB
+    if(_rx_length == 0){ //invalid
+      XBEE_STATS_ADD(length_errors);
+      _rx_count = 0;
+    } else if(_rx_length > XBEE_RX_BUFFER_SIZE - 4){ //too long for buffer (+4 for Frame, Length_H, Length_L and CheckSum)
+      XBEE_STATS_ADD(overflows);
+      _rx_count = 0;
+    }
+  } else if((_rx_count > 3) && (_rx_count == (int)(_rx_length + 4))){
+    //complete frame
+#ifdef XBEE_API_CAPTURE
+    Capture(true, _rx_buffer, _rx_count);
+#endif
+    if(CheckSum(&_rx_buffer[3], _rx_length) == _rx_buffer[_rx_length + 3]){
+#ifdef XBEE_USE_PACING
+      _handling = true; //the buffer is in use
+      HandleFrame(&_rx_buffer[3], _rx_length);
+      _handling = false;
+#else
+      HandleFrame(&_rx_buffer[3], _rx_length);
+#endif
+      handled = true;
+    } else {
+      XBEE_TRACE(XBEE_TRACE_CHECKSUM_ERROR, _rx_buffer[3], 0, _rx_length);
+      XBEE_STATS_ADD(checksum_errors);
+    }
+    _rx_count = 0;
+  }
+#ifdef XBEE_USE_FRAME_POOL
+  if(_rx_count == 0){ //release until the next frame
+    XBeeFramePool::Release(_rx_buffer);
+    _rx_buffer = NULL;
+  }
+#endif
+  
+  return handled;
+}
+
+//-------------------------------------------------------------------------------------------------
+
+// Parse the frames available in the serial port
+//    (returns the number of valid frames handled)
+unsigned int XBeeMaster::ParseFrames(void){
+#ifdef USE_SOFTWARE_SERIAL
+  _xbee->listen();
+#endif
+  
+  unsigned int count = 0;
+  while(_xbee->available()){
+    if(ParseByte((byte)_xbee->read()))
+      count++;
+  }
+  return count;
+}
+
+//-------------------------------------------------------------------------------------------------
+
+// Advance the current job and the requests (call often, e.g. in loop())
+//    (returns XBEE_JOB_BUSY while running, otherwise the result of the last job:
+//      1 when succesful, 0 if not initialized or none, 13 if timeout of '+++', 14 if other timeout, 23 if number of tries exeeded)
+//    NOTE: never blocks waiting for the XBee
+//    NOTE: when no job is running, receives the frames that complete the requests (don't mix with Listen())
+byte XBeeMaster::Poll(void){
+  if(!_initialized)
+    return 0;
+  
+  CheckRequests();
+  
+  //receive the frames (API mode) when not in command mode
+  if(_job == XBEE_JOB_NONE){
+    ParseFrames();
+#ifdef XBEE_USE_NODE_QUEUE
+    SendHeld(); //of the nodes that woke up
+#endif
+#ifdef XBEE_USE_FRAGMENTS
+    CheckMessages();
+#endif
+#ifdef XBEE_USE_LINK_MONITOR
+    CheckLinks();
+#endif
+#ifdef XBEE_USE_TX_QUEUE
+    SendQueue();
+#endif
+    return _job_result;
+  }
+  
+  //send the command of the current step
+  if(!_job_waiting){
+    //check number of tries
+    if(_job_tries > 3)
+      return FinishJob(23);
+    //reset buffer
+    for(int i=0 ; i < XBEE_JOB_BUFFER_SIZE ; i++)
+      _job_reply[i] = EMPTY_CHAR;
+    SendJobCommand();
+    if(_job_step == XBEE_STEP_ENTER)
+      XBEE_STATS_ADD(command_mode_entries);
+    if(_job_tries > 0)
+      XBEE_STATS_ADD(retries);
+    _job_tries++;
+    //leave command mode - doesn't need to verify 'ok' back, leaves with timeout
+    if(_job_step == XBEE_STEP_EXIT)
+      return FinishJob(1);
+    _job_count = 0;
+    _job_start = millis(); //get the current time
+    _job_waiting = true;
+    return XBEE_JOB_BUSY;
+  }
+  
+  //read response - 'OK\0', value ended by '\0' or the values of the batched read (one line each)
+  boolean is_value = ((_job_step == XBEE_STEP_SH) || (_job_step == XBEE_STEP_SL) || (_job_step == XBEE_STEP_VR) || (_job_step == XBEE_STEP_HV));
+  boolean is_read = (_job_step == XBEE_STEP_READ);
+  byte expected = (is_read ? XBEE_JOB_BUFFER_SIZE : (is_value ? 9 : 3));
+  boolean complete = false;
+  while(!complete && _xbee->available()){
+    _job_reply[_job_count] = _xbee->read();
+    _job_count++; //careful for next commands!
+    if(_job_count >= expected){
+      complete = true;
+    } else if(is_value && (_job_reply[_job_count - 1] == 0x0D)){
+      //exit if found carriage return before end (meaning first bytes are 0)
+      while(_xbee->available()){ //ignore next characters
+        _xbee->read();
+      }
+      complete = true;
+    } else if(is_read && (_job_reply[_job_count - 1] == 0x0D)){
+      byte lines = 0;
+      for(byte i=0 ; i < _job_count ; i++){
+        if(_job_reply[i] == 0x0D)
+          lines++;
+      }
+      complete = (lines == JOB_READ_VALUES);
+    }
+  }
+  //check if timeout
+  if(!complete){
+    if((millis() - _job_start) >= AT_TIMEOUT){
+      XBEE_STATS_ADD(timeouts);
+      return FinishJob((_job_step == XBEE_STEP_ENTER) ? 13 : 14);
+    }
+    return XBEE_JOB_BUSY;
+  }
+  XBEE_TRACE(XBEE_TRACE_AT_REPLY, _job_count, _job_reply[0], _job_reply[1]);
+  _job_waiting = false; //resend if invalid
+  if(is_read){
+    if(!CompareJobValues()) //invalid response
+      return XBEE_JOB_BUSY;
+  } else if(is_value){
+    if(_job_reply[_job_count - 1] != 0x0D) //invalid response
+      return XBEE_JOB_BUSY;
+    if((_job_step == XBEE_STEP_VR) || (_job_step == XBEE_STEP_HV)){
+      //store in the version (up to 4 digits)
+      if(_job_count > 5)
+        return XBEE_JOB_BUSY;
+      word version = 0;
+      for(byte i=0 ; i < (_job_count - 1) ; i++){
+        int digit = HexDigit(_job_reply[i]);
+        if(digit < 0) //invalid response
+          return XBEE_JOB_BUSY;
+        version = (version << 4) | digit;
+      }
+      if(_job_step == XBEE_STEP_VR)
+        _job_firmware = version;
+      else
+        _job_hardware = version;
+    } else {
+      //store in serial number (MSB for SH and LSB for SL)
+      byte offset = ((_job_step == XBEE_STEP_SH) ? 0 : 8);
+      byte leading_zeros = 9 - _job_count;
+      for(int i=0 ; i < leading_zeros ; i++)
+        _job_serial[offset + i] = '0';
+      for(int i=leading_zeros ; i < 8 ; i++)
+        _job_serial[offset + i] = _job_reply[i - leading_zeros];
+    }
+  } else if((_job_reply[0] != 0x4F) || (_job_reply[1] != 0x4B) || (_job_reply[2] != 0x0D)){ //not 'OK' resend
+    return XBEE_JOB_BUSY;
+  }
+  
+  //go to the next step
+  _job_step = NextJobStep();
+  _job_tries = 0;
+  return XBEE_JOB_BUSY;
+}
+
+//-------------------------------------------------------------------------------------------------
+
+// Probe the XBee in command mode with the current baudrate
+//    (returns TRUE if the XBee answered 'OK', leaving the command mode)
+//    NOTE: assumes that the line was quiet for the guard time
+boolean XBeeMaster::ProbeCommandMode(void){
+  _xbee->write((const uint8_t*)"+++", 3);
+  XBEE_TRACE(XBEE_TRACE_AT_COMMAND, '+', '+', 1);
+  XBEE_STATS_ADD(command_mode_entries);
+  
+  //look for 'OK\r' (ignores the other characters)
+  byte matched = 0;
+  unsigned long start = millis();
+  while((millis() - start) < (GUARD_TIME + GUARD_TIME_MARGIN)){
+    if(!_xbee->available())
+      continue;
+    char c = _xbee->read();
+    if(c == "OK\r"[matched])
+      matched++;
+    else
+      matched = ((c == 'O') ? 1 : 0);
+    if(matched == 3){
+      _xbee->write((const uint8_t*)"ATCN\r", 5); //leave command mode
+      XBEE_TRACE(XBEE_TRACE_AT_COMMAND, 'C', 'N', 1);
+      return true;
+    }
+  }
+  return false;
+}
+
+//-------------------------------------------------------------------------------------------------
+
+#ifdef XBEE_USE_TX_QUEUE
+// Store a frame in the queue
+//    (returns FALSE if the queue is full or if there is no storage for the frame)
+boolean XBeeMaster::QueueFrame(byte* frame, int length, byte priority){
+  for(byte i=0 ; i < XBEE_TX_QUEUE_SIZE ; i++){
+    XBeeQueuedFrame* queued = &_queue[i];
+    if(queued->frame.GetDataLength() != 0)
+      continue;
+    
+    if(!queued->frame.Append(&frame[3], length - 4)) //the length and the CheckSum are the same
+      return false;
+    queued->priority = priority;
+    queued->order = _queue_order++;
+    return true;
+  }
+  return false;
+}
+
+//-------------------------------------------------------------------------------------------------
+#endif // XBEE_USE_TX_QUEUE
+
+// Process all the bytes available in the serial port, handling every complete frame
+//    (returns the number of valid frames handled, 0 if not initialized or a job is running)
+//    NOTE: each frame is dispatched to the handler of its API identifier (see SetFrameHandler()),
+//          besides completing the requests and reporting to the Send Callback
+//    NOTE: a partial frame is kept for the next call
+unsigned int XBeeMaster::Process(void){
+  if(!_initialized)
+    return 0;
+  
+  if(_job != XBEE_JOB_NONE) //command mode
+    return 0;
+  
+  CheckRequests();
+  unsigned int count = ParseFrames();
+#ifdef XBEE_USE_NODE_QUEUE
+  SendHeld(); //of the nodes that woke up
+#endif
+#ifdef XBEE_USE_FRAGMENTS
+  CheckMessages();
+#endif
+#ifdef XBEE_USE_LINK_MONITOR
+  CheckLinks();
+#endif
+#ifdef XBEE_USE_TX_QUEUE
+  SendQueue();
+#endif
+  
+  return count;
+}
+
+//-------------------------------------------------------------------------------------------------
+
+#ifdef XBEE_USE_PACING
+// Release the sent frame that was answered (measuring the drain rate with the TX status)
+void XBeeMaster::ReleaseFrame(byte api_identifier, byte frame_id){
+  for(byte i=0 ; i < XBEE_TX_WINDOW ; i++){
+    XBeeTXFrame* sent = &_tx_window[i];
+    if((sent->frame_id == 0) || (sent->frame_id != frame_id))
+      continue;
+    
+    if((api_identifier == API_TX_STATUS) && (sent->length > 0)){
+      unsigned long drain = (_rx_time - sent->time) / sent->length;
+      _tx_drain = (3 * _tx_drain + drain) / 4;
+    }
+    sent->frame_id = 0; //free
+    return;
+  }
+}
+
+//-------------------------------------------------------------------------------------------------
+#endif // XBEE_USE_PACING
+
+// Reopen the connection with the XBee
+//    NOTE: the partial frame is discarded
+void XBeeMaster::Reopen(long baudrate){
+  _xbee->flush();
+  _xbee->end();
+  _baudrate = baudrate;
+  _xbee->begin(_baudrate);
+  _rx_count = 0;
+}
+
+//-------------------------------------------------------------------------------------------------
+
+#ifdef XBEE_USE_RETRIES
+// Send a request again, with a new frame ID
+//    NOTE: the previous frame ID is kept to accept its late success (see HandleFrame())
+//    NOTE: the copy leaves the request while being sent, because the responses received
+//          while writing (see WaitToSend()) might complete the request
+void XBeeMaster::ResendRequest(byte index){
+  XBeeRequest* request = &_requests[index];
+  request->waiting = false;
+  request->attempt++;
+  request->previous_frame_id = request->frame_id;
+  request->frame_id = NextFrameID();
+  request->sent.SetFrameID(request->frame_id);
+  XBEE_STATS_ADD(retries);
+  
+  byte frame_id = request->frame_id;
+  XBeeFrame frame;
+  frame.Take(&request->sent);
+  Send(&frame);
+  if((request->result == XBEE_REQUEST_PENDING) && (request->frame_id == frame_id)){
+    request->sent.Take(&frame); //to send again
+    request->start_time = millis(); //wait from the end of the transmission
+  }
+}
+
+//-------------------------------------------------------------------------------------------------
+#endif // XBEE_USE_RETRIES
+
+#ifdef XBEE_API_CAPTURE
+// Replay a capture, passing the received frames to the parser (as if received by Poll())
+//    (returns the number of received frames replayed, 0 if not initialized)
+//    NOTE: if 'realtime' is TRUE, keeps the original time between the frames, otherwise replays at maximum speed
+//    NOTE: the sent frames are skipped and the capture is disabled during the replay
+//    NOTE: blocks until the end of 'input' (nothing received for LISTEN_TIMEOUT, so it can be a live stream)
+//    NOTE: a record cut short is discarded (the next record starts a new frame)
+unsigned int XBeeMaster::Replay(Stream* input, boolean realtime){
+  if(!_initialized)
+    return 0;
+  
+  Print* capture = _capture;
+  _capture = NULL; //don't capture again
+  
+  unsigned int count = 0;
+  boolean first = true;
+  unsigned long first_time = 0;
+  unsigned long start_time = micros();
+  byte header[8];
+  while(true){
+    //find the begin of the record
+    int c = XBeeProfile::Read(input);
+    if(c < 0)
+      break;
+    if(c != XBEE_CAPTURE_RECORD)
+      continue;
+    header[0] = c;
+    
+    //read the rest of the header
+    byte i;
+    for(i=1 ; i < 8 ; i++){
+      c = XBeeProfile::Read(input);
+      if(c < 0)
+        break;
+      header[i] = c;
+    }
+    if(i < 8)
+      break;
+    unsigned long time = header[2] | ((unsigned long)header[3] << 8) | ((unsigned long)header[4] << 16) | ((unsigned long)header[5] << 24);
+    word length = header[6] | (header[7] << 8);
+    
+    //keep the original time
+    if(first){
+      first_time = time;
+      first = false;
+    } else if(realtime){
+      while((micros() - start_time) < (time - first_time)){ /* wait */ }
+    }
+    
+    //parse the received frames
+    boolean received = ((header[1] & 0x80) != 0);
+    _rx_count = 0; //each record has whole frames
+    word j;
+    for(j=0 ; j < length ; j++){
+      c = XBeeProfile::Read(input);
+      if(c < 0)
+        break;
+      if(received)
+        ParseByte(c);
+    }
+    if(j < length) //cut short
+      break;
+    if(received)
+      count++;
+    
+    CheckRequests();
+  }
+  _rx_count = 0; //discard the frame of a record cut short
+  
+  _capture = capture;
+  return count;
+}
+
+//-------------------------------------------------------------------------------------------------
+#endif // XBEE_API_CAPTURE
+
+// Read the identity of the XBee (serial number - SH and SL, firmware version - VR and hardware version - HV)
+//    (returns 1 when succesful, 0 if not initialized, 3 if a job is running, otherwise the result of the request that failed)
+//    NOTE: the values are cached (see GetAddress(), GetFirmwareVersion() and GetHardwareVersion()),
+//          so read them again only after changing the XBee
+//    NOTE: blocks until all the values are read
+byte XBeeMaster::ReadIdentity(unsigned long timeout){
+  if(!_initialized)
+    return 0;
+  
+  if(_job != XBEE_JOB_NONE)
+    return 3;
+  
+  char* commands[4] = {SH, SL, VR, HV};
+  unsigned long values[4];
+  ByteArray value;
+  InitializeByteArray(&value);
+  byte res = 1;
+  for(byte i=0 ; i < 4 ; i++){
+    res = WaitRequest(RequestAT(commands[i], NULL, &value, timeout));
+    if((res == 1) && !XBeeMessages::DecodeInteger(value.ptr, value.length, &values[i]))
+      res = XBEE_REQUEST_ERROR;
+    if(res != 1)
+      break;
+  }
+  FreeByteArray(&value);
+  if(res != 1)
+    return ((res == 0) ? XBEE_REQUEST_ERROR : res); //0 if no free request
+  
+  _serial_number = ((uint64_t)values[0] << 32) | values[1];
+  _firmware_version = values[2];
+  _hardware_version = values[3];
+  return 1;
+}
+
+//-------------------------------------------------------------------------------------------------
+
+// Request a local AT command (to read the parameter, use NULL or "" for 'command_values')
+//    (returns the handle of the request, 0 if not initialized, invalid command or no free request)
+//    NOTE: the result is given by RequestStatus() and the data of the response is stored in 'value' (can be NULL)
+//  !!! 'command_values' in HEX format
+byte XBeeMaster::RequestAT(char* command_name, char* command_values, ByteArray* value, unsigned long timeout){
+  if(!_initialized)
+    return 0;
+  
+  //check if valid command
+  if(StrLength(command_name) != 2)
+    return 0;
+  
+  byte index = AddRequest(API_AT_COMMAND, value, timeout);
+  if(index == XBEE_MAX_REQUESTS)
+    return 0;
+  
+  ByteArray message;
+  InitializeByteArray(&message);
+  ResizeByteArray(&message, 4);
+  message.ptr[0] = API_AT_COMMAND;
+  message.ptr[2] = command_name[0];
+  message.ptr[3] = command_name[1];
+  
+  //add values
+  if((command_values != NULL) && (StrLength(command_values) > 0)){
+    ByteArray temp;
+    InitializeByteArray(&temp);
+    HexStringToByteArray(command_values, &temp);
+    JoinByteArray(&message, &temp);
+    FreeByteArray(&temp);
+  }
+  
+  return SendRequest(index, &message);
+}
+
+//-------------------------------------------------------------------------------------------------
+
+// Request a remote AT command (to read the parameter, use NULL or "" for 'command_values')
+//    (returns the handle of the request, 0 if not initialized, invalid command or no free request)
+//    NOTE: the result is given by RequestStatus() and the data of the response is stored in 'value' (can be NULL)
+//    NOTE: with XBEE_TIMEOUT_AUTO, the timeout is given by the link with the destination (see SetLinkMonitor())
+//  !!! ALL strings in HEX format, EXCEPT for 'command_name'
+byte XBeeMaster::RequestRemoteAT(char* destination_address_64bit, char* destination_address_16bit, byte transmission_type, char* command_name, char* command_values, ByteArray* value, unsigned long timeout, byte options){
+  if(!_initialized)
+    return 0;
+  
+  ByteArray message;
+  InitializeByteArray(&message);
+  if(!XBeeMessages::CreateRemoteATRequest(&message, destination_address_64bit, destination_address_16bit, transmission_type, command_name, command_values, options))
+    return 0;
+  
+  //destination (none for broadcast)
+  byte* address = &message.ptr[2];
+  byte address_length = 8;
+  if((message.ptr[10] == 0xFF) && (message.ptr[11] == 0xFF)){
+    address_length = 0;
+  } else if(transmission_type == USE_16_BIT_ADDRESS){
+    address = &message.ptr[10];
+    address_length = 2;
+  }
+  
+#ifdef XBEE_USE_LINK_MONITOR
+  if(timeout == XBEE_TIMEOUT_AUTO)
+    timeout = LinkTimeout(address, address_length);
+#endif
+  byte index = AddRequest(API_REMOTE_AT_COMMAND_REQUEST, value, timeout);
+  if(index == XBEE_MAX_REQUESTS){
+    FreeByteArray(&message);
+    return 0;
+  }
+  memcpy(_requests[index].address, address, address_length);
+  _requests[index].address_length = address_length;
+  
+  return SendRequest(index, &message);
+}
+
+//-------------------------------------------------------------------------------------------------
+
+// Wait for data from a given address (64-bit or 16-bit)
+//    (returns the handle of the request, 0 if not initialized, invalid address or no free request)
+//    NOTE: the result is given by RequestStatus() and the received data is stored in 'data' (can be NULL)
+//  !!! 'source_address' in HEX format
+byte XBeeMaster::RequestRX(char* source_address, ByteArray* data, unsigned long timeout){
+  if(!_initialized)
+    return 0;
+  
+  ByteArray address;
+  InitializeByteArray(&address);
+  HexStringToByteArray(source_address, &address);
+  byte type;
+  switch(address.length){
+    case 8: type = API_RX_64_BIT; break;
+    case 2: type = API_RX_16_BIT; break;
+    default:
+      FreeByteArray(&address);
+      return 0;
+  }
+  
+  byte index = AddRequest(type, data, timeout);
+  if(index < XBEE_MAX_REQUESTS){
+    for(int i=0 ; i < address.length ; i++)
+      _requests[index].address[i] = address.ptr[i];
+    _requests[index].address_length = address.length;
+  }
+  FreeByteArray(&address);
+  
+  if(index == XBEE_MAX_REQUESTS)
+    return 0;
+  
+  return (index + 1); //nothing to send
+}
+
+//-------------------------------------------------------------------------------------------------
+
+// Get the status of a request
+//    (returns XBEE_REQUEST_PENDING while waiting, 0 if not initialized or invalid handle, otherwise the result:
+//      1 when succesful, 10 if error, 11 if invalid command, 12 if invalid parameter,
+//      40 if no response (or no ACK), 41 if CCA failure, 42 if purged, 50 on timeout)
+//    NOTE: the handle is released when the result is returned
+byte XBeeMaster::RequestStatus(byte handle){
+  if(!_initialized)
+    return 0;
+  
+  if((handle == 0) || (handle > XBEE_MAX_REQUESTS))
+    return 0;
+  
+  byte res = _requests[handle - 1].result;
+  if(res != XBEE_REQUEST_PENDING)
+    _requests[handle - 1].result = 0; //free
+  
+  return res;
+}
+
+//-------------------------------------------------------------------------------------------------
+
+// Request the transmission of data
+//    (returns the handle of the request, 0 if not initialized, invalid address or no free request)
+//    NOTE: the result (from the TX status) is given by RequestStatus()
+//    NOTE: 'destination_address' is ignored for USE_BROADCAST
+//    NOTE: with XBEE_TIMEOUT_AUTO, the timeout is given by the link with the destination (see SetLinkMonitor())
+//  !!! 'destination_address' in HEX format
+byte XBeeMaster::RequestTX(char* destination_address, byte transmission_type, ByteArray* data, unsigned long timeout){
+  if(!_initialized)
+    return 0;
+  
+  ByteArray message;
+  InitializeByteArray(&message);
+  if(transmission_type == USE_64_BIT_ADDRESS){
+    HexStringToByteArray(destination_address, &message);
+    if(message.length != 8){
+      FreeByteArray(&message);
+      return 0;
+    }
+  } else if(transmission_type == USE_16_BIT_ADDRESS){
+    HexStringToByteArray(destination_address, &message);
+    if(message.length != 2){
+      FreeByteArray(&message);
+      return 0;
+    }
+  } else { //broadcast
+    ResizeByteArray(&message, 2);
+    message.ptr[0] = 0xFF;
+    message.ptr[1] = 0xFF;
+  }
+  
+  byte type = ((message.length == 8) ? API_TX_RESQUEST_64_BIT : API_TX_RESQUEST_16_BIT);
+  byte address_length = ((transmission_type == USE_BROADCAST) ? 0 : message.length);
+#ifdef XBEE_USE_LINK_MONITOR
+  if(timeout == XBEE_TIMEOUT_AUTO)
+    timeout = LinkTimeout(message.ptr, address_length);
+#endif
+  byte index = AddRequest(type, NULL, timeout);
+  if(index == XBEE_MAX_REQUESTS){
+    FreeByteArray(&message);
+    return 0;
+  }
+  memcpy(_requests[index].address, message.ptr, address_length); //destination
+  _requests[index].address_length = address_length;
+  
+  //insert API identifier and frame ID before the address, and the options after
+  ByteArray temp;
+  InitializeByteArray(&temp);
+  ResizeByteArray(&temp, 2);
+  temp.ptr[0] = type;
+  JoinByteArray(&temp, &message);
+  FreeByteArray(&message);
+  ResizeByteArray(&temp, temp.length + 1);
+  temp.ptr[temp.length - 1] = 0x00; //options
+  if(data != NULL)
+    JoinByteArray(&temp, data);
+  
+  return SendRequest(index, &temp);
+}
+
+//-------------------------------------------------------------------------------------------------
+
+#ifdef XBEE_USE_RETRIES
+// Get the class of the retransmissions of a type of request
+//    (returns XBEE_RETRY_CLASSES if the type isn't sent again)
+byte XBeeMaster::RetryClass(byte type){
+  switch(type){
+    case API_TX_RESQUEST_64_BIT:
+    case API_TX_RESQUEST_16_BIT: return XBEE_RETRY_TX;
+    case API_REMOTE_AT_COMMAND_REQUEST: return XBEE_RETRY_REMOTE_AT;
+  }
+  return XBEE_RETRY_CLASSES;
+}
+
+//-------------------------------------------------------------------------------------------------
+
+// Get the delay before sending a request again (exponential backoff with jitter)
+//    (returns the delay in milliseconds)
+//    NOTE: the backoff is doubled for each attempt up to the maximum, and the delay is random between
+//          half the backoff and the backoff, so the nodes that failed together don't send again together
+//    NOTE: the xorshift generator is seeded with the serial number and the time of the first retransmission
+unsigned long XBeeMaster::RetryDelay(byte request_class, byte attempt){
+  XBeeRetryPolicy* policy = &_retry_policies[request_class];
+  unsigned long backoff = policy->backoff;
+  for(byte i=1 ; i < attempt ; i++)
+    backoff = ((backoff > (policy->max_backoff / 2)) ? policy->max_backoff : (backoff << 1));
+  if(backoff > policy->max_backoff)
+    backoff = policy->max_backoff;
+  
+  if(_retry_random == 0){
+    _retry_random = (unsigned long)_serial_number ^ (unsigned long)(_serial_number >> 32) ^ micros();
+    if(_retry_random == 0)
+      _retry_random = 1;
+  }
+  _retry_random ^= _retry_random << 13;
+  _retry_random ^= _retry_random >> 17;
+  _retry_random ^= _retry_random << 5;
+  
+  return ((backoff - (backoff / 2)) + (_retry_random % ((backoff / 2) + 1)));
+}
+
+//-------------------------------------------------------------------------------------------------
+
+// Schedule a failed request to be sent again (see SetRetryPolicy())
+//    (returns TRUE if the request stays pending)
+//    NOTE: only the failures that might be transient are sent again (no response or ACK, CCA failure and timeout)
+//    NOTE: the failures received while waiting to send again are ignored (late responses of the previous attempt)
+boolean XBeeMaster::RetryRequest(byte index, byte result, unsigned long rtt){
+  XBeeRequest* request = &_requests[index];
+  if(request->waiting)
+    return (result != 1);
+  
+  if((result != XBEE_REQUEST_NO_RESPONSE) && (result != XBEE_REQUEST_CCA_FAILURE) && (result != XBEE_REQUEST_TIMEOUT))
+    return false;
+  
+  byte request_class = RetryClass(request->type);
+  if((request_class == XBEE_RETRY_CLASSES) || (request->sent.GetDataLength() == 0) || (request->attempt >= _retry_policies[request_class].attempts))
+    return false;
+#ifdef XBEE_USE_NODE_QUEUE
+  if(request->frame.length > 0) //never sent (the destination didn't wake up)
+    return false;
+#endif
+  
+#ifdef XBEE_USE_LINK_MONITOR
+  //the failed attempt counts in the statistics of the link
+  if(request->address_length > 0)
+    UpdateLink(request->address, request->address_length, result, rtt);
+#endif
+  (void)rtt; //only the link monitor uses it
+  XBEE_TRACE(XBEE_TRACE_REQUEST_RETRY, index + 1, result, request->attempt);
+  request->waiting = true;
+  request->retry_time = millis() + RetryDelay(request_class, request->attempt);
+  return true;
+}
+
+//-------------------------------------------------------------------------------------------------
+#endif // XBEE_USE_RETRIES
+
+#ifdef XBEE_API_STATS
+// Reset the statistics
+void XBeeMaster::ResetStats(void){
+  memset(&_stats, 0, sizeof(XBeeStats));
+}
+
+//-------------------------------------------------------------------------------------------------
+#endif // XBEE_API_STATS
+
+// Restore the XBee's parameters to their factory settings
+//    (returns 1 when succesful, 0 if not initialized, 13 if timeout of '+++', 14 if other timeout, 23 if number of tries exeeded)
+//    NOTE: assumes that the XBee is currently configured with the baudrate of the connection (see GetBaudrate())
+//    NOTE: if an error as occured, the previous transmission cannot be used, so must restart the transmission with a valid baudrate
+byte XBeeMaster::Restore(void){
+  return Restore(_baudrate);
+}
+  
+
+// Restore the XBee's parameters to their factory settings given a baudrate
+//    (returns 1 when succesful, 0 if not initialized, 13 if timeout of '+++', 14 if other timeout, 23 if number of tries exeeded)
+//    NOTE: if an error as occured, the previous transmission cannot be used, so must restart the transmission with a valid baudrate
+//    NOTE: blocks until the job is finished (see StartRestore() and Poll() for the non blocking version)
+byte XBeeMaster::Restore(long baudrate){
+  byte res = StartRestore(baudrate);
+  while(res == XBEE_JOB_BUSY)
+    res = Poll();
+  
+  return res;
+}
+
+//-------------------------------------------------------------------------------------------------
+
+// Select the best channel with the energy (ED) and active (AS) scans, and change the channel of the network to it
+//    (returns 1 when succesful, 0 if not initialized, 3 if a job is running, 14 if the scans failed,
+//      40 if any of the slaves didn't answer)
+//    NOTE: the channels are ranked by the energy found (in -dBm) minus SCAN_PAN_PENALTY for each PAN found,
+//          only from the channels scanned (SC) that are valid for both XBee and XBee PRO (0x0C to 0x17)
+//    NOTE: the new channel is written in the slaves (Remote AT, 64-bit addresses in 'slaves') before
+//          being written in this XBee, so the slaves that didn't answer are left in the previous channel
+//    NOTE: blocks while scanning (up to SCAN_TIMEOUT for each scan)
+byte XBeeMaster::SelectChannel(char** slaves, byte num_slaves){
+  if(!_initialized)
+    return 0;
+  
+  if(_job != XBEE_JOB_NONE)
+    return 3;
+  
+  //channels of the scan (bit 0 for 0x0B to bit 15 for 0x1A)
+  ByteArray value;
+  InitializeByteArray(&value);
+  unsigned long mask = 0;
+  if((WaitRequest(RequestAT(SC, NULL, &value)) != 1) || !XBeeMessages::DecodeInteger(value.ptr, value.length, &mask)){
+    FreeByteArray(&value);
+    return 14;
+  }
+  
+  //energy in each channel
+  if((WaitRequest(RequestAT(ED, NULL, &value, SCAN_TIMEOUT)) != 1) || (value.length <= 0)){
+    FreeByteArray(&value);
+    return 14;
+  }
+  
+  //PANs in each channel
+  byte pans[16];
+  for(int i=0 ; i < 16 ; i++)
+    pans[i] = 0;
+  _scan_pans = pans;
+  _scan_done = false;
+  byte handle = RequestAT(AS, NULL, NULL, SCAN_TIMEOUT);
+  unsigned long start = millis();
+  while((handle != 0) && !_scan_done && ((millis() - start) < SCAN_TIMEOUT)){
+    CheckRequests();
+    ParseFrames();
+  }
+  _scan_pans = NULL;
+  CancelRequest(handle);
+  
+  //rank the channels
+  byte channel = 0;
+  int best = -1000;
+  byte index = 0; //of the energy
+  for(byte i=0 ; (i < 16) && (index < value.length) ; i++){
+    if(!(mask & (1UL << i)))
+      continue;
+    int score = value.ptr[index++] - (SCAN_PAN_PENALTY * pans[i]);
+    byte current = 0x0B + i;
+    if((current < 0x0C) || (current > 0x17))
+      continue;
+    if((score > best) || ((score == best) && (current == _network_channel))){ //keep the current one if tied
+      best = score;
+      channel = current;
+    }
+  }
+  FreeByteArray(&value);
+  if(channel == 0)
+    return 14;
+  
+  char values[3];
+  values[0] = ASCIIByteToHexByte((channel & 0xF0) >> 4);
+  values[1] = ASCIIByteToHexByte(channel & 0x0F);
+  values[2] = '\0';
+  
+  //slaves (write before applying, because they can't answer in the new channel)
+  byte res = 1;
+  for(byte i=0 ; i < num_slaves ; i++){
+    if((WaitRequest(RequestRemoteAT(slaves[i], NULL, USE_64_BIT_ADDRESS, CH, values, NULL, LISTEN_TIMEOUT, XBEE_REMOTE_QUEUE)) != 1) ||
+        (WaitRequest(RequestRemoteAT(slaves[i], NULL, USE_64_BIT_ADDRESS, WR, NULL, NULL, LISTEN_TIMEOUT, XBEE_REMOTE_QUEUE)) != 1)){
+      res = 40;
+      continue;
+    }
+    WaitRequest(RequestRemoteAT(slaves[i], NULL, USE_64_BIT_ADDRESS, AC, NULL, NULL)); //might not answer (already in the new channel)
+  }
+  
+  //this XBee
+  if((WaitRequest(RequestAT(CH, values, NULL)) != 1) || (WaitRequest(RequestAT(WR, NULL, NULL)) != 1))
+    return 14;
+  _network_channel = channel;
+  
+  return res;
+}
+
+//-------------------------------------------------------------------------------------------------
+
+// Send the message
+//    NOTE: returns as soon as the frame is handed to the serial port (or to the queue, see SetPriority()),
+//          the completion is reported by the Send Callback when the response is listened
+boolean XBeeMaster::Send(void){
+  if(!_initialized)
+    return false;
+  
+#ifdef XBEE_USE_FRAME_POOL
+  if(_tx_frame != NULL){
+    SendFrame(_tx_frame, _tx_length);
+    XBeeFramePool::Release(_tx_frame);
+    _tx_frame = NULL;
+    return true;
+  }
+#endif
+  
+  if(_barray.length <= 0)
+    return false;
+  
+  SendFrame(_barray.ptr, _barray.length);
+  FreeByteArray(&_barray); //free memory
+  
+  return true;
+}
+
+//------------------------------------------
+
+// Send a frame (see XBeeFrame)
+//  (returns FALSE if not initialized or if the frame is empty)
+//    NOTE: the frame isn't changed, so it can be sent again
+//    NOTE: doesn't change the frame created by CreateFrame()
+boolean XBeeMaster::Send(XBeeFrame* frame){
+  if(!_initialized)
+    return false;
+  
+  if(frame->GetDataLength() == 0)
+    return false;
+  
+  SendFrame(frame->GetBytes(), frame->GetLength());
+  
+  return true;
+}
+
+//-------------------------------------------------------------------------------------------------
+
+// Send a frame (through the queue with XBEE_USE_TX_QUEUE)
+//    NOTE: the frame is written at once if the queue is empty and the serial port is free, otherwise it's queued
+//          (if it can't be queued, the queued frames are sent first)
+void XBeeMaster::SendFrame(byte* frame, int length){
+#ifdef XBEE_USE_TX_QUEUE
+  SendQueue(); //the ones that are ready
+  if((GetQueuedFrames() == 0) && IsWritable(frame, length)){
+    WriteFrame(frame, length);
+    return;
+  }
+  
+  byte priority = ((_queue_priority == XBEE_PRIORITY_AUTO) ? FramePriority(frame, length) : _queue_priority);
+  if(QueueFrame(frame, length, priority))
+    return;
+  
+  FlushQueue();
+#endif
+  WriteFrame(frame, length);
+}
+
+//-------------------------------------------------------------------------------------------------
+
+#ifdef XBEE_USE_NODE_QUEUE
+// Send the held requests whose destination is awake (or no longer a sleeping node)
+//    NOTE: called after parsing the frames (see Poll() and CheckRequests()), because while handling a frame
+//          the responses can't be received, so the frames couldn't wait for the window (see WaitToSend())
+//    NOTE: the held requests are sent in a burst, in the order they were made
+void XBeeMaster::SendHeld(void){
+#ifdef XBEE_USE_PACING
+  if(_handling) //sent after the frame
+    return;
+#endif
+  if(!_wake_pending)
+    return;
+  _wake_pending = false;
+  
+  unsigned long current_time = millis();
+  while(true){
+    //get the oldest held request
+    byte index = XBEE_MAX_REQUESTS;
+    for(byte i=0 ; i < XBEE_MAX_REQUESTS ; i++){
+      XBeeRequest* request = &_requests[i];
+      if((request->result != XBEE_REQUEST_PENDING) || (request->frame.length <= 0))
+        continue;
+      byte node = FindDestination(&request->frame);
+      if((node < XBEE_MAX_NODES) && ((current_time - _nodes[node].last_time) >= _nodes[node].awake_time)) //asleep
+        continue;
+      if((index == XBEE_MAX_REQUESTS) || ((current_time - request->start_time) > (current_time - _requests[index].start_time)))
+        index = i;
+    }
+    if(index == XBEE_MAX_REQUESTS)
+      break;
+    
+    if(SendOwnFrame(&_requests[index].frame)) //frees the frame
+      _requests[index].start_time = millis(); //wait from the end of the transmission
+    else
+      CompleteRequest(index, XBEE_REQUEST_ERROR, NULL, 0);
+  }
+}
+
+//-------------------------------------------------------------------------------------------------
+#endif // XBEE_USE_NODE_QUEUE
+
+// Send a message in its own frame (the requests, fragments and held frames)
+//    (returns FALSE if the frame is bigger than XBEE_TX_BUFFER_SIZE)
+//    NOTE: 'message' is freed
+//    NOTE: doesn't change the frame created by CreateFrame(), which belongs to the user
+boolean XBeeMaster::SendOwnFrame(ByteArray* message){
+  boolean res = false;
+  if((message->length + 4) <= XBEE_TX_BUFFER_SIZE){ //the same limit as CreateFrame()
+    XBeeFrame frame;
+    res = (frame.Append(message->ptr, message->length) && Send(&frame));
+  }
+  FreeByteArray(message); //free memory
+  
+  return res;
+}
+
+//-------------------------------------------------------------------------------------------------
+
+#ifdef XBEE_USE_TX_QUEUE
+// Send the queued frames while the serial port is free (one frame at a time, see NextQueued())
+void XBeeMaster::SendQueue(void){
+  byte index = NextQueued();
+  while((index < XBEE_TX_QUEUE_SIZE) && IsWritable(_queue[index].frame.GetBytes(), _queue[index].frame.GetLength())){
+    SendQueued(index);
+    index = NextQueued();
+  }
+}
+
+//-------------------------------------------------------------------------------------------------
+
+// Send a queued frame (and count the lower priorities passed over)
+//    NOTE: the frame leaves the queue before being written, because the responses received
+//          while writing (see WaitToSend()) might send other frames
+void XBeeMaster::SendQueued(byte index){
+  XBeeFrame frame;
+  frame.Take(&_queue[index].frame); //free
+  byte priority = _queue[index].priority;
+  
+  _queue_passed[priority] = 0;
+  byte waiting = 0; //lower priorities with queued frames (bit of each one)
+  for(byte i=0 ; i < XBEE_TX_QUEUE_SIZE ; i++){
+    XBeeQueuedFrame* queued = &_queue[i];
+    if((queued->frame.GetDataLength() != 0) && (queued->priority > priority))
+      waiting |= (1 << queued->priority);
+  }
+  for(byte i=0 ; i < XBEE_PRIORITIES ; i++){
+    if((waiting & (1 << i)) && (_queue_passed[i] < 0xFF))
+      _queue_passed[i]++;
+  }
+  
+  WriteFrame(frame.GetBytes(), frame.GetLength());
+}
+
+//-------------------------------------------------------------------------------------------------
+#endif // XBEE_USE_TX_QUEUE
+
+#ifdef XBEE_USE_FRAGMENTS
+// Send a fragment (without TX status)
+void XBeeMaster::SendFragment(byte* address, byte address_length, byte kind, byte message_id, byte index, byte count, byte* data, int length){
+  ByteArray message;
+  InitializeByteArray(&message);
+  ResizeByteArray(&message, 3 + address_length + XBEE_FRAGMENT_HEADER + length);
+  int pos = 0;
+  message.ptr[pos++] = ((address_length == 8) ? API_TX_RESQUEST_64_BIT : API_TX_RESQUEST_16_BIT);
+  message.ptr[pos++] = 0; //frame ID (no response)
+  for(int i=0 ; i < address_length ; i++)
+    message.ptr[pos++] = address[i];
+  message.ptr[pos++] = 0x00; //options
+  message.ptr[pos++] = XBEE_FRAGMENT_MARK;
+  message.ptr[pos++] = kind;
+  message.ptr[pos++] = message_id;
+  message.ptr[pos++] = index;
+  message.ptr[pos++] = count;
+  for(int i=0 ; i < length ; i++)
+    message.ptr[pos++] = data[i];
+  
+  SendOwnFrame(&message);
+}
+
+//-------------------------------------------------------------------------------------------------
+
+// Send a message bigger than a frame (in fragments of XBEE_FRAGMENT_SIZE bytes)
+//    (returns 1 if started, 0 if not initialized, invalid address or invalid size, 3 if other message is being sent)
+//    NOTE: the fragments are sent by Poll() without waiting for each one, and the destination answers
+//          the last one with the missing fragments (sent again) or with the ACK
+//    NOTE: the result is given by MessageStatus()
+//    NOTE: 'data' is NOT copied, so it must not be changed until the end
+//    NOTE: the destination must also use XBeeMaster with XBEE_USE_FRAGMENTS (broadcast is not supported)
+//  !!! 'destination_address' in HEX format
+byte XBeeMaster::SendMessage(char* destination_address, byte transmission_type, ByteArray* data){
+  if(!_initialized)
+    return 0;
+  
+  if((data == NULL) || (data->length <= 0) || (data->length > (XBEE_FRAGMENT_SIZE * XBEE_FRAGMENT_MAX)))
+    return 0;
+  
+  if(_message_tx.result == XBEE_REQUEST_PENDING)
+    return 3;
+  
+  ByteArray address;
+  InitializeByteArray(&address);
+  HexStringToByteArray(destination_address, &address);
+  if(((transmission_type == USE_64_BIT_ADDRESS) && (address.length != 8)) ||
+      ((transmission_type == USE_16_BIT_ADDRESS) && (address.length != 2)) ||
+      ((transmission_type != USE_64_BIT_ADDRESS) && (transmission_type != USE_16_BIT_ADDRESS))){
+    FreeByteArray(&address);
+    return 0;
+  }
+  
+  XBeeLongMessage* message = &_message_tx;
+  for(int i=0 ; i < address.length ; i++)
+    message->address[i] = address.ptr[i];
+  message->address_length = address.length;
+  FreeByteArray(&address);
+  
+  _message_id++;
+  message->message_id = _message_id;
+  message->data = data;
+  message->count = (data->length + XBEE_FRAGMENT_SIZE - 1) / XBEE_FRAGMENT_SIZE;
+  for(int i=0 ; i < (XBEE_FRAGMENT_MAX / 8) ; i++)
+    message->bitmap[i] = 0;
+  for(byte i=0 ; i < message->count ; i++)
+    FRAGMENT_SET(message->bitmap, i); //all to send
+  message->next = 0;
+  message->tries = 0;
+  message->time = millis() - FRAGMENT_INTERVAL; //send the first one in the next Poll()
+  message->result = XBEE_REQUEST_PENDING;
+  
+  return 1;
+}
+
+//-------------------------------------------------------------------------------------------------
+#endif // XBEE_USE_FRAGMENTS
+
+// Send the AT command of the current step of the job
+void XBeeMaster::SendJobCommand(void){
+  char command[17]; //longest is 'ATID,CH,MY,BD,AP\r'
+  byte length = 4;
+  
+  command[0] = 'A';
+  command[1] = 'T';
+  switch(_job_step){
+    case XBEE_STEP_ENTER:
+      command[0] = '+';
+      command[1] = '+';
+      command[2] = '+';
+      length = 3;
+      break;
+    case XBEE_STEP_ID:
+      command[2] = 'I';
+      command[3] = 'D';
+      command[4] = ASCIIByteToHexByte((_network_id & 0xF000) >> 12);
+      command[5] = ASCIIByteToHexByte((_network_id & 0x0F00) >> 8);
+      command[6] = ASCIIByteToHexByte((_network_id & 0x00F0) >> 4);
+      command[7] = ASCIIByteToHexByte(_network_id & 0x000F);
+      length = 8;
+      break;
+    case XBEE_STEP_CH:
+      command[2] = 'C';
+      command[3] = 'H';
+      command[4] = ASCIIByteToHexByte((_network_channel & 0x00F0) >> 4);
+      command[5] = ASCIIByteToHexByte(_network_channel & 0x000F);
+      length = 6;
+      break;
+    case XBEE_STEP_MY:
+      command[2] = 'M';
+      command[3] = 'Y';
+      command[4] = 'F'; // 0xFFFF
+      command[5] = 'F';
+      command[6] = 'F';
+      command[7] = 'F';
+      length = 8;
+      break;
+    case XBEE_STEP_BD:
+      command[2] = 'B';
+      command[3] = 'D';
+      command[4] = ASCIIByteToHexByte(_job_bd);
+      length = 5;
+      break;
+    case XBEE_STEP_AP:
+      command[2] = 'A';
+      command[3] = 'P';
+      command[4] = (_job_master ? '1' : '0'); //mode 1 (mode 2 not yet implemented in XBeeMessages - see README)
+      length = 5;
+      break;
+    case XBEE_STEP_READ: //one line for each value
+      memcpy(&command[2], "ID,CH,MY,BD,AP", 14);
+      length = 16;
+      break;
+    case XBEE_STEP_PIN:
+      command[2] = _job_pins[_job_pin].pin[0];
+      command[3] = _job_pins[_job_pin].pin[1];
+      command[4] = _job_pins[_job_pin].value + 48; //use '0' instead of 0
+      length = 5;
+      break;
+    case XBEE_STEP_RE:
+      command[2] = 'R';
+      command[3] = 'E';
+      break;
+    case XBEE_STEP_WR:
+      command[2] = 'W';
+      command[3] = 'R';
+      break;
+    case XBEE_STEP_SH:
+      command[2] = 'S';
+      command[3] = 'H';
+      break;
+    case XBEE_STEP_SL:
+      command[2] = 'S';
+      command[3] = 'L';
+      break;
+    case XBEE_STEP_VR:
+      command[2] = 'V';
+      command[3] = 'R';
+      break;
+    case XBEE_STEP_HV:
+      command[2] = 'H';
+      command[3] = 'V';
+      break;
+    default: //XBEE_STEP_EXIT
+      command[2] = 'C';
+      command[3] = 'N';
+      break;
+  }
+  if(_job_step != XBEE_STEP_ENTER)
+    command[length++] = 0x0D; //carriage return
+  
+  _xbee->write((const uint8_t*)command, length);
+  XBEE_TRACE(XBEE_TRACE_AT_COMMAND, command[2], ((length > 3) ? command[3] : '+'), _job_tries + 1);
+}
+
+//-------------------------------------------------------------------------------------------------
+
+// Stamp the request of a frame written to the XBee with the end of the transmission
+//    NOTE: write() returns with up to SERIAL_TX_BUFFER bytes still being sent,
+//          so their time in the serial port is added
+void XBeeMaster::StampRequest(byte* frame, int length){
+  if((length < 5) || !XBeeFrame::HasFrameID(frame[3]) || (frame[4] == 0))
+    return;
+  
+  int pending = ((length < SERIAL_TX_BUFFER) ? length : SERIAL_TX_BUFFER);
+  unsigned long sent_time = micros() + (pending * (10000000UL / _baudrate)); //10 bits for each byte
+  for(byte i=0 ; i < XBEE_MAX_REQUESTS ; i++){
+    if((_requests[i].result == XBEE_REQUEST_PENDING) && (_requests[i].frame_id == frame[4])){
+      _requests[i].sent_time = sent_time;
+      return;
+    }
+  }
+}
+
+//-------------------------------------------------------------------------------------------------
+
+// Send the frame of a request
+//    (returns the handle of the request, 0 if not sent)
+//    NOTE: 'message' is freed
+byte XBeeMaster::SendRequest(byte index, ByteArray* message){
+  message->ptr[1] = _requests[index].frame_id; //all requests have the frame ID after the API identifier
+  
+#ifdef XBEE_USE_RETRIES
+  //keep a copy to send again (not sent again if it doesn't fit)
+  byte request_class = RetryClass(_requests[index].type);
+  if((request_class < XBEE_RETRY_CLASSES) && (_retry_policies[request_class].attempts > 1)){
+    if(!_requests[index].sent.Append(message->ptr, message->length))
+      _requests[index].sent.Clear();
+  }
+#endif
+  
+#ifdef XBEE_USE_NODE_QUEUE
+  //hold the frame while the destination sleeps (sent by WakeNode())
+  byte node = FindDestination(message);
+  if((node < XBEE_MAX_NODES) && ((millis() - _nodes[node].last_time) >= _nodes[node].awake_time)){
+    byte held = 0;
+    for(byte i=0 ; i < XBEE_MAX_REQUESTS ; i++){
+      if((_requests[i].result == XBEE_REQUEST_PENDING) && (_requests[i].frame.length > 0) && (FindDestination(&_requests[i].frame) == node))
+        held++;
+    }
+    if(held >= XBEE_MAX_HELD){ //leave the other requests for the other nodes
+      FreeByteArray(message);
+#ifdef XBEE_USE_RETRIES
+      _requests[index].sent.Clear();
+#endif
+      _requests[index].result = 0; //free
+      return 0;
+    }
+    _requests[index].frame.ptr = message->ptr;
+    _requests[index].frame.length = message->length;
+    message->ptr = NULL;
+    message->length = 0;
+    return (index + 1);
+  }
+#endif
+  
+  if(!SendOwnFrame(message)){
+#ifdef XBEE_USE_RETRIES
+    _requests[index].sent.Clear();
+#endif
+    _requests[index].result = 0; //free
+    return 0;
+  }
+  _requests[index].start_time = millis(); //wait from the end of the transmission
+  
+  return (index + 1);
+}
+
+//-------------------------------------------------------------------------------------------------
+
+// Send a static frame (see XBEE_STATIC_AT() and XBEE_STATIC_REMOTE_AT())
+//  (returns FALSE if not initialized or if the frame is invalid)
+//    NOTE: the frame is written straight from the flash to the XBee, without a request
+//          (with XBEE_USE_PACING, XBEE_API_CAPTURE or XBEE_USE_TX_QUEUE, it is copied to the RAM first, up to STATIC_FRAME_SIZE)
+//    NOTE: doesn't change the frame created by CreateFrame()
+boolean XBeeMaster::SendStatic(const byte* frame){
+  if(!_initialized)
+    return false;
+  
+  if(pgm_read_byte(&frame[0]) != FRAME_DELIMITER)
+    return false;
+  int length = ((pgm_read_byte(&frame[1]) << 8) | pgm_read_byte(&frame[2])) + 4;
+  
+#if defined(XBEE_USE_PACING) || defined(XBEE_API_CAPTURE) || defined(XBEE_USE_TX_QUEUE)
+  if(length > STATIC_FRAME_SIZE)
+    return false;
+  
+  byte buffer[STATIC_FRAME_SIZE];
+  for(int i=0 ; i < length ; i++)
+    buffer[i] = pgm_read_byte(&frame[i]);
+  SendFrame(buffer, length);
+#else
+  for(int i=0 ; i < length ; i++)
+    _xbee->write(pgm_read_byte(&frame[i]));
+  XBEE_TRACE(XBEE_TRACE_FRAME_TX, pgm_read_byte(&frame[3]), pgm_read_byte(&frame[4]), length - 4);
+  XBEE_STATS_ADD(frames_sent[StatsIndex(pgm_read_byte(&frame[3]))]);
+#endif
+  
+  return true;
+}
+
+//-------------------------------------------------------------------------------------------------
+
+#ifdef XBEE_API_CAPTURE
+// Set the output of the capture of the frames (sent and received)
+//    NOTE: use NULL to disable
+//    NOTE: 'port_id' (0 to 127) identifies the XBee in the capture
+void XBeeMaster::SetCapture(Print* output, byte port_id){
+  _capture = output;
+  _capture_port = port_id;
+}
+
+//-------------------------------------------------------------------------------------------------
+#endif // XBEE_API_CAPTURE
+
+// Set the computer serial
+boolean XBeeMaster::SetComputer(HardwareSerial* computer){
+  boolean res = false;
+  if(_initialized){
+    if((word)computer != (word)_xbee){ //assign only if not used by XBee (because both are pointers, cast to word to compare even for different types)
+      _computer = computer;
+      _computer->begin(BAUDRATE_PC);
+      _use_computer = true;
+      res = true;
+    }
+  }
+  return res;
+}
+
+//-------------------------------------------------------------------------------------------------
+
+#ifdef XBEE_USE_PACING
+// Set the pin connected to the CTS of the XBee (DIO7 with D7 = 1), so the frames are written only while asserted (LOW)
+//    NOTE: use XBEE_NO_PIN to disable
+//    NOTE: each chunk waits for the previous one to leave the serial port (see WriteFrame()),
+//          so the frames with a CTS block while being written
+void XBeeMaster::SetCTSPin(byte pin){
+  if(!_initialized)
+    return;
+  
+  _cts_pin = pin;
+  if(_cts_pin != XBEE_NO_PIN)
+    pinMode(_cts_pin, INPUT);
+}
+
+//-------------------------------------------------------------------------------------------------
+#endif // XBEE_USE_PACING
+
+#ifdef XBEE_USE_TX_QUEUE
+// Set the priority of the next frames sent (XBEE_PRIORITY_CONTROL, XBEE_PRIORITY_NORMAL or XBEE_PRIORITY_BULK)
+//    NOTE: with XBEE_PRIORITY_AUTO (default), the priority is given by the API identifier: AT and Remote AT
+//          commands are XBEE_PRIORITY_CONTROL, fragments of data are XBEE_PRIORITY_BULK and the rest is XBEE_PRIORITY_NORMAL
+//    NOTE: the frames are queued while the serial port is busy and sent by Poll() at the frame boundaries,
+//          the highest priority first, but without starving the lower ones (see QUEUE_STARVATION)
+//    NOTE: the timeout of a request includes the time in the queue
+void XBeeMaster::SetPriority(byte priority){
+  if(!_initialized)
+    return;
+  
+  if((priority >= XBEE_PRIORITIES) && (priority != XBEE_PRIORITY_AUTO))
+    return;
+  
+  _queue_priority = priority;
+}
+
+//-------------------------------------------------------------------------------------------------
+#endif // XBEE_USE_TX_QUEUE
+
+// Set the handler of the received frames of an API identifier (0x80 to 0x9F, e.g. API_RX_64_BIT or API_MODEM_STATUS)
+//    (returns FALSE if not initialized or invalid API identifier)
+//    NOTE: use NULL to disable
+//    NOTE: the frames are dispatched by Process() and Poll()
+//    NOTE: the time of arrival of the frame is given by GetFrameTime()
+boolean XBeeMaster::SetFrameHandler(byte api_identifier, XBeeFrameHandler handler){
+  if(!_initialized)
+    return false;
+  
+  if((api_identifier & 0xE0) != 0x80)
+    return false;
+  
+  _handlers[api_identifier & 0x1F] = handler;
+  return true;
+}
+
+//-------------------------------------------------------------------------------------------------
+
+#ifdef XBEE_USE_LINK_MONITOR
+// Set the interval of the samples of the link monitor (DB of each node, then EA and EC of the local XBee)
+//    (returns FALSE if not initialized or if RR and EA couldn't be read to tune the retries)
+//    NOTE: Poll() and Process() take one sample at a time (using one of the XBEE_MAX_REQUESTS),
+//          so a round takes (nodes + 2) intervals - use 0 to stop the samples
+//    NOTE: the round trip time of the requests to the nodes is always measured (see GetLink())
+//    NOTE: with 'tune_retries', RR is raised when more than 1/4 of the requests of a round had ACK failures (EA)
+//          and lowered after LINK_TUNE_SENT requests without them (not saved with WR)
+boolean XBeeMaster::SetLinkMonitor(unsigned long interval, boolean tune_retries){
+  if(!_initialized)
+    return false;
+  
+  _link_interval = interval;
+  _link_time = millis();
+  _link_tune = false;
+  if(!tune_retries)
+    return true;
+  
+  //current values
+  ByteArray value;
+  InitializeByteArray(&value);
+  unsigned long retries, failures;
+  boolean res = (WaitRequest(RequestAT(RR, NULL, &value)) == 1) && XBeeMessages::DecodeInteger(value.ptr, value.length, &retries) &&
+                (WaitRequest(RequestAT(EA, NULL, &value)) == 1) && XBeeMessages::DecodeInteger(value.ptr, value.length, &failures);
+  FreeByteArray(&value);
+  if(!res)
+    return false;
+  
+  _link_retries = retries;
+  _link_ack_failures = failures;
+  _link_sent = 0;
+  _link_tune = true;
+  return true;
+}
+
+//-------------------------------------------------------------------------------------------------
+#endif // XBEE_USE_LINK_MONITOR
+
+// Set the XBee network Channel variable
+//  (returns TRUE if changed successfully)
+//    NOTE: range is defined for both XBee and XBee PRO
+boolean XBeeMaster::SetNetworkChannel(byte channel){
+  boolean res = false;
+  if(_initialized){
+    if((channel >= 0x0C) && (channel <= 0x17)){ //XBee: 0x0B to 0x1A || XBee PRO: 0x0C to 0x17
+      _network_channel = channel;
+      res = true;
+    }
+  }
+  
+  return res;
+}
+
+//-------------------------------------------------------------------------------------------------
+
+#ifdef XBEE_USE_NODE_QUEUE
+// Set a node that sleeps (cyclic sleep), so the requests to it are held until it wakes up
+//    (returns FALSE if not initialized, invalid address or no free node)
+//    NOTE: the node is awake for 'awake_time' milliseconds after each frame received from it
+//          (use the time before sleep of the node - ST), 0 removes the node and sends its held requests
+//    NOTE: the held requests are sent in a burst with the first frame received after sleeping,
+//          and their timeout starts when sent. While held, they wait for the learned period between
+//          the wake ups plus 'awake_time' (without limit while the period is unknown, see GetWakePeriod())
+//    NOTE: up to XBEE_MAX_HELD requests are held for each node (the requests fail while full),
+//          out of the XBEE_MAX_REQUESTS shared by all the requests
+//    NOTE: the node is asleep until the first frame is received from it
+//  !!! 'address' in HEX format (64 or 16-bit, the same as the requests and the received frames)
+boolean XBeeMaster::SetSleepingNode(char* address, unsigned long awake_time){
+  if(!_initialized)
+    return false;
+  
+  ByteArray temp;
+  InitializeByteArray(&temp);
+  HexStringToByteArray(address, &temp);
+  if((temp.length != 8) && (temp.length != 2)){
+    FreeByteArray(&temp);
+    return false;
+  }
+  
+  byte node = FindNode(temp.ptr, temp.length);
+  if(awake_time == 0){ //remove
+    FreeByteArray(&temp);
+    if(node < XBEE_MAX_NODES){
+      _nodes[node].address_length = 0; //free
+      _wake_pending = true;
+      SendHeld(); //no longer held
+    }
+    return true;
+  }
+  
+  if(node == XBEE_MAX_NODES){
+    for(node=0 ; node < XBEE_MAX_NODES ; node++){
+      if(_nodes[node].address_length == 0) //free
+        break;
+    }
+    if(node == XBEE_MAX_NODES){
+      FreeByteArray(&temp);
+      return false;
+    }
+    for(int i=0 ; i < temp.length ; i++)
+      _nodes[node].address[i] = temp.ptr[i];
+    _nodes[node].address_length = temp.length;
+    _nodes[node].last_time = millis() - awake_time; //asleep
+    _nodes[node].wake_time = 0;
+    _nodes[node].period = 0;
+  }
+  _nodes[node].awake_time = awake_time;
+  FreeByteArray(&temp);
+  
+  return true;
+}
+
+//-------------------------------------------------------------------------------------------------
+#endif // XBEE_USE_NODE_QUEUE
+
+// Set the parameters of a profile (see GetProfile())
+//    (returns 1 when succesful, 0 if not initialized, 3 if a job is running, 31 if invalid profile,
+//      otherwise the result of the request that failed)
+//    NOTE: the parameters are queued and applied together with AC, then written with WR if 'write' is TRUE
+//    NOTE: the parameters not supported by the firmware are skipped (e.g. to replace the XBee by a newer one)
+//    NOTE: blocks until all the parameters are set
+byte XBeeMaster::SetProfile(ByteArray* profile, boolean write){
+  if(!_initialized)
+    return 0;
+  
+  if(_job != XBEE_JOB_NONE)
+    return 3;
+  
+  if(!XBeeProfile::Check(profile))
+    return PROFILE_INVALID;
+  
+  int end = profile->length - 1; //before the checksum
+  int offset = XBEE_PROFILE_HEADER;
+  byte res;
+  while(offset < end){
+    byte* record = &profile->ptr[offset];
+    offset += 3 + record[2];
+    
+    byte index = AddRequest(API_AT_COMMAND_QUEUE, NULL, LISTEN_TIMEOUT);
+    if(index == XBEE_MAX_REQUESTS)
+      return XBEE_REQUEST_ERROR;
+    
+    ByteArray message;
+    InitializeByteArray(&message);
+    ResizeByteArray(&message, 4 + record[2]);
+    message.ptr[0] = API_AT_COMMAND_QUEUE;
+    message.ptr[2] = record[0];
+    message.ptr[3] = record[1];
+    for(byte i=0 ; i < record[2] ; i++)
+      message.ptr[4 + i] = record[3 + i];
+    
+    res = WaitRequest(SendRequest(index, &message));
+    if(res == XBEE_REQUEST_INVALID_COMMAND) //not supported
+      continue;
+    if(res != 1)
+      return ((res == 0) ? XBEE_REQUEST_ERROR : res); //0 if not sent
+  }
+  
+  //apply and write
+  res = WaitRequest(RequestAT(AC, NULL, NULL));
+  if((res == 1) && write)
+    res = WaitRequest(RequestAT(WR, NULL, NULL));
+  
+  return ((res == 0) ? XBEE_REQUEST_ERROR : res);
+}
+
+//-------------------------------------------------------------------------------------------------
+
+// Set the callback for the completion of the requests
+//    NOTE: use NULL to disable
+void XBeeMaster::SetRequestCallback(XBeeRequestCallback callback){
+  _request_callback = callback;
+}
+
+//-------------------------------------------------------------------------------------------------
+
+#ifdef XBEE_USE_RETRIES
+// Set the policy of the retransmissions of a class of requests (XBEE_RETRY_TX or XBEE_RETRY_REMOTE_AT)
+//  (returns FALSE if not initialized or if invalid class or number of attempts)
+//    NOTE: 'attempts' includes the first one (1 disables the retransmissions), 'backoff' is the delay
+//          before the first retransmission and is doubled for each one up to 'max_backoff' (in milliseconds)
+//    NOTE: the requests that fail with no response (or ACK), CCA failure or timeout are sent again with a new
+//          frame ID, and the late success of the previous attempt completes the request (see RetryRequest())
+//    NOTE: each attempt waits for the timeout of the request, so the request completes after the sum
+//          of the timeouts and the delays in the worst case
+//    NOTE: the default is RETRY_ATTEMPTS, RETRY_BACKOFF and RETRY_BACKOFF_MAX for both classes
+boolean XBeeMaster::SetRetryPolicy(byte request_class, byte attempts, unsigned long backoff, unsigned long max_backoff){
+  if(!_initialized)
+    return false;
+  
+  if((request_class >= XBEE_RETRY_CLASSES) || (attempts == 0))
+    return false;
+  
+  _retry_policies[request_class].attempts = attempts;
+  _retry_policies[request_class].backoff = backoff;
+  _retry_policies[request_class].max_backoff = ((max_backoff < backoff) ? backoff : max_backoff);
+  return true;
+}
+
+//-------------------------------------------------------------------------------------------------
+#endif // XBEE_USE_RETRIES
+
+// Set the callback for the completion of the sent frames
+//    NOTE: use NULL to disable
+void XBeeMaster::SetSendCallback(XBeeSendCallback callback){
+  _send_callback = callback;
+}
+
+//-------------------------------------------------------------------------------------------------
+
+// Set the XBee network ID variable
+//  (returns FALSE if not initialized)
+boolean XBeeMaster::SetNetworkID(word id){
+  if(!_initialized)
+    return false;
+  
+  _network_id = id;
+  return true;
+}
+
+//-------------------------------------------------------------------------------------------------
+
+#ifdef XBEE_API_STATS
+// Get the bucket of the histograms for a round trip time
+//    (limits in XBEE_STATS_RTT_LIMITS, the last bucket is for the longer times)
+byte XBeeMaster::StatsBucket(unsigned long rtt){
+  static const word limits[XBEE_STATS_RTT_BUCKETS - 1] = XBEE_STATS_RTT_LIMITS;
+  
+  byte bucket = 0;
+  while((bucket < (XBEE_STATS_RTT_BUCKETS - 1)) && (rtt >= limits[bucket]))
+    bucket++;
+  
+  return bucket;
+}
+
+//-------------------------------------------------------------------------------------------------
+
+// Get the index of the counters of an API identifier
+//    (returns XBEE_STATS_API_OTHER for the identifiers not listed)
+byte XBeeMaster::StatsIndex(byte api_identifier){
+  switch(api_identifier){
+    case API_TX_RESQUEST_64_BIT: return 0;
+    case API_TX_RESQUEST_16_BIT: return 1;
+    case API_AT_COMMAND: return 2;
+    case API_AT_COMMAND_QUEUE: return 3;
+    case API_REMOTE_AT_COMMAND_REQUEST: return 4;
+    case API_RX_64_BIT: return 5;
+    case API_RX_16_BIT: return 6;
+    case API_RX_64_BIT_IO: return 7;
+    case API_RX_16_BIT_IO: return 8;
+    case API_AT_COMMAND_RESPONSE: return 9;
+    case API_TX_STATUS: return 10;
+    case API_MODEM_STATUS: return 11;
+    case API_REMOTE_COMMAND_RESPONSE: return 12;
+  }
+  return XBEE_STATS_API_OTHER;
+}
+
+//-------------------------------------------------------------------------------------------------
+#endif // XBEE_API_STATS
+
+// Set up the connection with the XBee and the state of the XBeeMaster (see Initialize())
+//    NOTE: resets the requests and the state of the options
+void XBeeMaster::Setup(void){
+  _xbee->begin(_baudrate); //begin transmission
+  InitializeByteArray(&_barray); //initialize Byte Array
+  _serial_number = 0; //unknown
+  _firmware_version = 0;
+  _hardware_version = 0;
+  for(int i=0 ; i < XBEE_MAX_REQUESTS ; i++){
+    _requests[i].result = 0; //free
+#ifdef XBEE_USE_NODE_QUEUE
+    InitializeByteArray(&_requests[i].frame);
+#endif
+#ifdef XBEE_USE_RETRIES
+    _requests[i].sent.Clear();
+#endif
+  }
+#ifdef XBEE_USE_RETRIES
+  for(int i=0 ; i < XBEE_RETRY_CLASSES ; i++){
+    _retry_policies[i].attempts = RETRY_ATTEMPTS;
+    _retry_policies[i].backoff = RETRY_BACKOFF;
+    _retry_policies[i].max_backoff = RETRY_BACKOFF_MAX;
+  }
+  _retry_random = 0; //seeded by the first retransmission
+#endif
+#ifdef XBEE_USE_NODE_QUEUE
+  for(int i=0 ; i < XBEE_MAX_NODES ; i++)
+    _nodes[i].address_length = 0; //free
+  _wake_pending = false;
+#endif
+#ifdef XBEE_USE_PACING
+  for(int i=0 ; i < XBEE_TX_WINDOW ; i++)
+    _tx_window[i].frame_id = 0; //free
+  _tx_drain = PACING_DRAIN;
+  _tx_ready = micros();
+  _cts_pin = XBEE_NO_PIN;
+  _handling = false;
+#endif
+#ifdef XBEE_USE_TX_QUEUE
+  for(int i=0 ; i < XBEE_TX_QUEUE_SIZE ; i++)
+    _queue[i].frame.Clear(); //free
+  _queue_order = 0;
+  for(int i=0 ; i < XBEE_PRIORITIES ; i++)
+    _queue_passed[i] = 0;
+  _queue_priority = XBEE_PRIORITY_AUTO;
+  _queue_free = micros();
+#endif
+#ifdef XBEE_USE_LINK_MONITOR
+  for(int i=0 ; i < XBEE_MAX_LINKS ; i++)
+    _links[i].address_length = 0; //free
+  _link_interval = 0;
+  _link_sample = LINK_SAMPLE_EC; //the first sample is of the first node
+  _link_handle = 0;
+  InitializeByteArray(&_link_value);
+  _link_tune = false;
+  _link_sent = 0;
+  _link_ack_failures = 0;
+  _link_cca_failures = 0;
+#endif
+  _rx_count = 0;
+  _rx_time = micros();
+#ifdef XBEE_USE_FRAGMENTS
+  _message_id = 0;
+  _message_tx.result = 0; //free
+  _message_rx.result = 0; //free
+  InitializeByteArray(&_message_buffer);
+  _message_rx.data = &_message_buffer;
+#endif
+#ifdef XBEE_USE_FRAME_POOL
+  _tx_frame = NULL;
+  _rx_buffer = NULL;
+#endif
+#ifdef XBEE_API_STATS
+  memset(&_stats, 0, sizeof(XBeeStats));
+#endif
+  _initialized = true; //set
+}
+
+//-------------------------------------------------------------------------------------------------
+
+// Start the configuration of the current XBee as Master (API mode)
+//    (returns XBEE_JOB_BUSY if started, 0 if not initialized, 3 if other job is running, 33 if invalid user Baudrate)
+//    NOTE: call Poll() until it doesn't return XBEE_JOB_BUSY to get the result (same as ConfigureAsMaster())
+//    NOTE: with 'differential', only the parameters with different values are set (and written only if any was set)
+byte XBeeMaster::StartConfigureAsMaster(long baudrate, boolean differential){
+  return StartConfigureXBee(baudrate, true, differential);
+}
+
+//-------------------------------------------------------------------------------------------------
+
+// Start the configuration of the current XBee as Slave (AT mode)
+//    (returns XBEE_JOB_BUSY if started, 0 if not initialized, 3 if other job is running, 33 if invalid user Baudrate)
+//    NOTE: call Poll() until it doesn't return XBEE_JOB_BUSY to get the result (same as ConfigureAsSlave())
+//    NOTE: with 'differential', only the parameters with different values are set (and written only if any was set)
+byte XBeeMaster::StartConfigureAsSlave(long baudrate, boolean differential){
+  return StartConfigureXBee(baudrate, false, differential);
+}
+
+//-------------------------------------------------------------------------------------------------
+
+// Start the configuration of the pins
+//    (returns XBEE_JOB_BUSY if started, 0 if not initialized, 3 if other job is running, 30 if invalid number of pins)
+//    NOTE: call Poll() until it doesn't return XBEE_JOB_BUSY to get the result (same as ConfigurePins())
+//    NOTE: 'pins' must remain valid until the job is finished
+byte XBeeMaster::StartConfigurePins(XBeePin *pins, byte num_pins){
+  if(!_initialized)
+    return 0;
+  
+  if(_job != XBEE_JOB_NONE)
+    return 3;
+  
+  //check number of pins
+  if((num_pins == 0) || (num_pins > 9))
+    return 30;
+  
+  // Procedure:
+  //    1) enter command mode
+  //    2) configure
+  //    3) write changes
+  //    4) exit command mode
+  
+  _job_pins = pins;
+  _job_num_pins = num_pins;
+  _job_pin = 0;
+  
+  return StartJob(XBEE_JOB_PINS);
+}
+
+//-------------------------------------------------------------------------------------------------
+
+// Start the configuration of the current XBee
+//    (returns XBEE_JOB_BUSY if started, 0 if not initialized, 3 if other job is running, 33 if invalid user Baudrate)
+byte XBeeMaster::StartConfigureXBee(long baudrate, boolean master, boolean differential){
+  if(!_initialized)
+    return 0;
+  
+  if(_job != XBEE_JOB_NONE)
+    return 3;
+  
+  // Procedure:
+  //    1) enter command mode
+  //    1.1) read ID, CH, MY, BD and AP in one command (differential only)
+  //    2) set the network ID
+  //    3) set the network Channel
+  //    4) set the 16-bit address (slave only)
+  //    5) set the Baudrate
+  //    6) set de API mode
+  //        OBS: the differential configuration skips the parameters that already have the values
+  //    7) write changes (skipped if the differential configuration set none)
+  //    8.1) read SH
+  //    8.2) read SL
+  //    8.3) read VR
+  //    8.4) read HV
+  //        OBS: the address and the versions are cached (see GetAddress(), GetFirmwareVersion() and GetHardwareVersion())
+  //    9) exit command mode
+  
+  _job_bd = BaudrateIndex(_baudrate);
+  if(_job_bd == 0xFF)
+    return 33; //invalid baudrate
+  _job_master = master;
+  _job_differential = differential;
+  _job_diff = 0;
+  for(int i=0 ; i < 16 ; i++)
+    _job_serial[i] = CONTROL_CHAR;
+  _job_serial[16] = '\0';
+  _job_firmware = 0;
+  _job_hardware = 0;
+  
+  _xbee->end(); //end previous connection
+  _xbee->begin(baudrate); //begin connection
+  
+  return StartJob(XBEE_JOB_CONFIGURE);
+}
+
+//-------------------------------------------------------------------------------------------------
+
+// Start a job from the first step
+//    (returns XBEE_JOB_BUSY)
+byte XBeeMaster::StartJob(byte job){
+  _job = job;
+  _job_step = XBEE_STEP_ENTER;
+  _job_tries = 0;
+  _job_waiting = false;
+  
+  return XBEE_JOB_BUSY;
+}
+
+//-------------------------------------------------------------------------------------------------
+
+// Start to restore the XBee's parameters to their factory settings
+//    (returns XBEE_JOB_BUSY if started, 0 if not initialized, 3 if other job is running)
+//    NOTE: assumes that the XBee is currently configured with the baudrate of the connection (see GetBaudrate())
+//    NOTE: call Poll() until it doesn't return XBEE_JOB_BUSY to get the result (same as Restore())
+byte XBeeMaster::StartRestore(void){
+  return StartRestore(_baudrate);
+}
+
+
+// Start to restore the XBee's parameters to their factory settings given a baudrate
+//    (returns XBEE_JOB_BUSY if started, 0 if not initialized, 3 if other job is running)
+//    NOTE: call Poll() until it doesn't return XBEE_JOB_BUSY to get the result (same as Restore())
+byte XBeeMaster::StartRestore(long baudrate){
+  if(!_initialized)
+    return 0;
+  
+  if(_job != XBEE_JOB_NONE)
+    return 3;
+  
+  // Procedure:
+  //    1) enter command mode
+  //    2) restore defaults
+  //    3) write changes
+  //    4) exit command mode
+  
+  _xbee->end(); //end previous connection
+  _xbee->begin(baudrate); //begin connection
+  
+  return StartJob(XBEE_JOB_RESTORE);
+}
+
+//-------------------------------------------------------------------------------------------------
+
+// Unset the computer serial
+//  (returns FALSE if not initialized)
+boolean XBeeMaster::UnsetComputer(void){
+  if(!_initialized)
+    return false;
+  
+  _computer->end(); //end communication
+  _computer = NULL;
+  _use_computer = false; //reset
+  return true;
+}
+
+//-------------------------------------------------------------------------------------------------
+
+#ifdef XBEE_USE_LINK_MONITOR
+// Update the statistics of the link with a node by the result of a request
+//    NOTE: the node is added if not found (replacing the one without requests for longer)
+void XBeeMaster::UpdateLink(byte* address, byte address_length, byte result, unsigned long rtt){
+  unsigned long current_time = millis();
+  byte index = FindLink(address, address_length);
+  if(index == XBEE_MAX_LINKS){
+    index = 0;
+    for(byte i=0 ; i < XBEE_MAX_LINKS ; i++){
+      if(_links[i].address_length == 0){ //free
+        index = i;
+        break;
+      }
+      if((current_time - _links[i].last_time) > (current_time - _links[index].last_time))
+        index = i;
+    }
+    memset(&_links[index], 0, sizeof(XBeeLink));
+    memcpy(_links[index].address, address, address_length);
+    _links[index].address_length = address_length;
+  }
+  
+  XBeeLink* link = &_links[index];
+  link->last_time = current_time;
+  if(_link_sent < 0xFFFF)
+    _link_sent++;
+  
+  if((result == XBEE_REQUEST_NO_RESPONSE) || (result == XBEE_REQUEST_CCA_FAILURE) || (result == XBEE_REQUEST_TIMEOUT)){
+    if(link->failures < LINK_BACKOFF_MAX)
+      link->failures++;
+    if(link->losses < 0xFFFF)
+      link->losses++;
+    return;
+  }
+  
+  //RTTVAR = 3/4 RTTVAR + 1/4 |SRTT - RTT| and SRTT = 7/8 SRTT + 1/8 RTT
+  if(link->successes == 0){
+    link->srtt = rtt;
+    link->rttvar = rtt / 2;
+  } else {
+    unsigned long error = ((rtt > link->srtt) ? (rtt - link->srtt) : (link->srtt - rtt));
+    link->rttvar = (3 * link->rttvar + error) / 4;
+    link->srtt = (7 * link->srtt + rtt) / 8;
+  }
+  link->failures = 0;
+  if(link->successes < 0xFFFF)
+    link->successes++;
+}
+
+//-------------------------------------------------------------------------------------------------
+#endif // XBEE_USE_LINK_MONITOR
+
+// Wait for the result of a request
+//    (returns the result of the request, 0 if not initialized or invalid handle)
+//    NOTE: blocks until the response is received or the request times out (the handle is released)
+byte XBeeMaster::WaitRequest(byte handle){
+  byte res = RequestStatus(handle);
+  while(res == XBEE_REQUEST_PENDING){
+    CheckRequests();
+    ParseFrames();
+#ifdef XBEE_USE_TX_QUEUE
+    SendQueue();
+#endif
+    res = RequestStatus(handle);
+  }
+  
+  return res;
+}
+
+//-------------------------------------------------------------------------------------------------
+
+#ifdef XBEE_USE_PACING
+// Wait to send a frame (up to PACING_TIMEOUT)
+//    NOTE: the frames with response wait for a free place in the window of the sent frames (XBEE_TX_WINDOW)
+//          and the frames without response wait for the drain of the previous ones
+//    NOTE: the frame is sent anyway after the timeout (the XBee might drop it)
+void XBeeMaster::WaitToSend(byte* frame, int length){
+  unsigned long start = millis();
+  while((millis() - start) < PACING_TIMEOUT){
+    if(IsReadyToSend(frame, length))
+      return;
+    
+    //receive the responses (not while handling a frame, because the buffer is in use)
+    if(!_handling && (_job == XBEE_JOB_NONE))
+      ParseFrames();
+  }
+}
+
+//-------------------------------------------------------------------------------------------------
+#endif // XBEE_USE_PACING
+
+#ifdef XBEE_USE_NODE_QUEUE
+// Set a sleeping node as awake (a frame was received from it)
+//    NOTE: the period between the wake ups is learned from the first frame received after sleeping
+//    NOTE: the held requests are sent after handling the frame (see SendHeld())
+void XBeeMaster::WakeNode(byte* address, byte address_length){
+  byte node = FindNode(address, address_length);
+  if(node == XBEE_MAX_NODES)
+    return;
+  
+  XBeeNode* sleeping = &_nodes[node];
+  unsigned long current_time = millis();
+  if((current_time - sleeping->last_time) >= sleeping->awake_time){ //woke up
+    if(sleeping->wake_time != 0){
+      unsigned long period = current_time - sleeping->wake_time;
+      sleeping->period = ((sleeping->period == 0) ? period : ((3 * sleeping->period + period) / 4));
+    }
+    sleeping->wake_time = current_time;
+  }
+  sleeping->last_time = current_time;
+  _wake_pending = true;
+}
+
+//-------------------------------------------------------------------------------------------------
+#endif // XBEE_USE_NODE_QUEUE
+
+// Write a frame to the XBee (whole frame at once)
+//    NOTE: with XBEE_USE_PACING, waits to send the frame (see WaitToSend()) and writes it
+//          in chunks while the CTS is asserted (see SetCTSPin())
+void XBeeMaster::WriteFrame(byte* frame, int length){
+#ifdef XBEE_USE_PACING
+  WaitToSend(frame, length);
+  if(_cts_pin == XBEE_NO_PIN){
+    _xbee->write(frame, length);
+  } else {
+    for(int i=0 ; i < length ; i += CTS_CHUNK){
+#ifndef USE_SOFTWARE_SERIAL
+      _xbee->flush(); //the previous chunk left the serial port (write() only fills the buffer of the HardwareSerial)
+#endif
+      unsigned long start = millis();
+      while((digitalRead(_cts_pin) == HIGH) && ((millis() - start) < PACING_TIMEOUT))
+        ; //wait for the XBee
+      _xbee->write(&frame[i], (((length - i) < CTS_CHUNK) ? (length - i) : CTS_CHUNK));
+    }
+  }
+  
+  //track the frame
+  unsigned long current_time = micros();
+  if(HasResponse(frame, length)){
+    for(byte i=0 ; i < XBEE_TX_WINDOW ; i++){
+      if(_tx_window[i].frame_id == 0){
+        _tx_window[i].frame_id = frame[4];
+        _tx_window[i].api_identifier = frame[3];
+        _tx_window[i].length = length;
+        _tx_window[i].time = current_time;
+        break;
+      }
     }
-    current_time = millis();
+  } else {
+    _tx_ready = current_time + (length * _tx_drain);
   }
-  //check if timeout
-  if((current_time - start_time) >= AT_TIMEOUT)
-    return 14;
-#ifdef XBEE_API_DEBUG
-  //display on computer
-  if(_use_computer){
-    _computer->println(">> ATWR");
-    for(int i=0 ; i < BUFFER_SIZE ; i++)
-      _computer->print(c[i]);
-    _computer->println();
-  }
-#endif
-  if((c[0] != 0x4F) || (c[1] != 0x4B) || (c[2] != 0x0D)) //not 'OK' resend
-    goto resend_WR;
-  //-----------------------------------
-  // 4) EXIT COMMAND MODE
-  _xbee->write("ATCN"); //leave command mode - doesn't need to verify 'ok' back, leaves with timeout
-  _xbee->write(0x0D); //carriage return
-#ifdef XBEE_API_DEBUG
-  //display on computer
-  if(_use_computer)
-    _computer->println(">> ATCN");
+#else
+  _xbee->write(frame, length);
 #endif
-#undef BUFFER_SIZE
-  //-----------------------------------
-  // return
-  delay(10);
-  _xbee->flush();
-  _xbee->end();
-  _xbee->begin(9600); //start new connection with default value
+#ifdef XBEE_USE_TX_QUEUE
+  _queue_free = micros() + (length * (10000000UL / _baudrate)); //10 bits for each byte
+#endif
+  StampRequest(frame, length);
+#ifdef XBEE_API_CAPTURE
+  Capture(false, frame, length);
+#endif
+  XBEE_TRACE(XBEE_TRACE_FRAME_TX, frame[3], frame[4], length - 4);
+  XBEE_STATS_ADD(frames_sent[StatsIndex(frame[3])]);
+}
+
+//-------------------------------------------------------------------------------------------------
+//-------------------------------------------------------------------------------------------------
+//-------------------------------------------------------------------------------------------------
+
+// Create message to send a remote AT command
+//    (returns the string to pass to the XBee)
+//    NOTE: if the 16bit_address is invalid or the destination address, the mode is overridden to BROADCAST
+//    NOTE: use NULL or "" as 'command_values' to read the parameter
+//    NOTE: with XBEE_REMOTE_QUEUE in 'options', the change is applied only with AC
+//  !!! ALL strings in HEX format, EXCEPT for 'command_name'
+boolean XBeeMessages::CreateRemoteATRequest(ByteArray* barray_ptr, char* destination_address_64bit, char* destination_address_16bit, byte transmission_type, char* command_name, char* command_values, byte options){
+  //free if exists
+  if(barray_ptr->ptr != NULL)
+    FreeByteArray(barray_ptr);
   
-  return 1;
+  //check if valid command
+  if(StrLength(command_name) != 2) //not hex string
+    return false;
+  
+  //resize and store constant values
+  ResizeByteArray(barray_ptr, 15);
+  barray_ptr->ptr[0] = API_REMOTE_AT_COMMAND_REQUEST;
+  barray_ptr->ptr[1] = 0x05; //change here to have a response
+  
+  //store addresses
+  ByteArray temp64;
+  InitializeByteArray(&temp64);
+  HexStringToByteArray(destination_address_64bit, &temp64); //convert data
+  if(temp64.length == 8){
+    for(int i=0 ; i < 8 ; i++)
+      barray_ptr->ptr[2+i] = temp64.ptr[i];
+    switch(transmission_type){
+      case USE_64_BIT_ADDRESS:
+                barray_ptr->ptr[10] = 0xFF;
+                barray_ptr->ptr[11] = 0xFE;
+                break;
+      case USE_16_BIT_ADDRESS:
+                ByteArray temp16;
+                InitializeByteArray(&temp16);
+                HexStringToByteArray(destination_address_16bit, &temp16); //convert data
+                if(temp16.length == 2){
+                  barray_ptr->ptr[10] = temp16.ptr[0];
+                  barray_ptr->ptr[11] = temp16.ptr[1];
+                } else { //broadcast
+                  barray_ptr->ptr[10] = 0xFF;
+                  barray_ptr->ptr[11] = 0xFF;
+                }
+                FreeByteArray(&temp16);
+                break;
+      default: //broadcast
+                barray_ptr->ptr[10] = 0xFF;
+                barray_ptr->ptr[11] = 0xFF;
+                break;
+    }
+  } else {
+    for(int i=0 ; i < 8 ; i++)
+      barray_ptr->ptr[2+i] = 0;
+    barray_ptr->ptr[10] = 0xFF; //broadcast
+    barray_ptr->ptr[11] = 0xFF; //broadcast
+  }
+  FreeByteArray(&temp64);
+  
+  barray_ptr->ptr[12] = options; //apply changes (XBEE_REMOTE_APPLY) or not (XBEE_REMOTE_QUEUE)
+  
+  //store command
+  ByteArray temp_command;
+  InitializeByteArray(&temp_command);
+  StringToByteArray(command_name, &temp_command); //convert data (NOT HEX string)
+  barray_ptr->ptr[13] = temp_command.ptr[0];
+  barray_ptr->ptr[14] = temp_command.ptr[1];
+  FreeByteArray(&temp_command);
+
+  //add values (none to read the parameter)
+  if((command_values != NULL) && (StrLength(command_values) > 0)){
+    HexStringToByteArray(command_values, &temp_command);
+    JoinByteArray(barray_ptr, &temp_command);
+    FreeByteArray(&temp_command);
+  }
+  
+  return true;
+}
+
+
+// Create the frame to send a remote AT command
+//    (returns FALSE if invalid command or values, or if the frame is too long)
+//    NOTE: the same as the version with the Byte Array, but without the heap
+//  !!! ALL strings in HEX format, EXCEPT for 'command_name'
+boolean XBeeMessages::CreateRemoteATRequest(XBeeFrame* frame, char* destination_address_64bit, char* destination_address_16bit, byte transmission_type, char* command_name, char* command_values, byte options){
+  frame->Clear();
+  
+  //check if valid command
+  if(StrLength(command_name) != 2) //not hex string
+    return false;
+  
+  frame->Append(API_REMOTE_AT_COMMAND_REQUEST);
+  frame->Append(0x05); //change here to have a response
+  
+  //store addresses (broadcast if invalid)
+  if((destination_address_64bit != NULL) && (StrLength(destination_address_64bit) == 16) && frame->AppendHex(destination_address_64bit)){
+    if(transmission_type == USE_64_BIT_ADDRESS){
+      frame->Append(0xFF);
+      frame->Append(0xFE);
+    } else if((transmission_type != USE_16_BIT_ADDRESS) || (destination_address_16bit == NULL) ||
+              (StrLength(destination_address_16bit) != 4) || !frame->AppendHex(destination_address_16bit)){
+      frame->Append(0xFF); //broadcast
+      frame->Append(0xFF);
+    }
+  } else {
+    while(frame->GetDataLength() < 10)
+      frame->Append(0x00);
+    frame->Append(0xFF); //broadcast
+    frame->Append(0xFF);
+  }
+  
+  frame->Append(options); //apply changes (XBEE_REMOTE_APPLY) or not (XBEE_REMOTE_QUEUE)
+  frame->Append(command_name[0]);
+  frame->Append(command_name[1]);
+  
+  //add values (none to read the parameter)
+  if((command_values != NULL) && !frame->AppendHex(command_values)){
+    frame->Clear();
+    return false;
+  }
+  
+  return true;
+}
+
+//-------------------------------------------------------------------------------------------------
+
+// Decode the response of an AT or Remote AT command (frame without the header and the checksum)
+//    (returns FALSE if not a valid response)
+//    NOTE: the value points to the data of the frame, so it's valid while the frame is
+boolean XBeeMessages::DecodeATResponse(ByteArray* barray, XBeeATResponse* response){
+  return DecodeATResponse(barray->ptr, barray->length, response);
+}
+
+
+// Decode the response of an AT or Remote AT command
+//    (returns FALSE if not a valid response)
+//    NOTE: the value points to the data of the frame, so it's valid while the frame is
+boolean XBeeMessages::DecodeATResponse(XBeeFrame* frame, XBeeATResponse* response){
+  return DecodeATResponse(frame->GetData(), frame->GetDataLength(), response);
+}
+
+
+// Decode the response of an AT or Remote AT command (frame without the header and the checksum)
+//    (returns FALSE if not a valid response)
+//    NOTE: the value points to the data of the frame, so it's valid while the frame is
+boolean XBeeMessages::DecodeATResponse(byte* frame, int length, XBeeATResponse* response){
+  if((frame == NULL) || (length < 1))
+    return false;
+  
+  int offset; //of the command
+  switch(frame[0]){
+    case API_AT_COMMAND_RESPONSE:
+      if(length < 5)
+        return false;
+      for(int i=0 ; i < 8 ; i++)
+        response->address_64bit[i] = 0;
+      response->address_16bit = 0;
+      offset = 2;
+      break;
+    case API_REMOTE_COMMAND_RESPONSE:
+      if(length < 15)
+        return false;
+      for(int i=0 ; i < 8 ; i++)
+        response->address_64bit[i] = frame[2 + i];
+      response->address_16bit = (frame[10] << 8) | frame[11];
+      offset = 12;
+      break;
+    default:
+      return false;
+  }
+  
+  response->api_identifier = frame[0];
+  response->frame_id = frame[1];
+  response->command[0] = frame[offset];
+  response->command[1] = frame[offset + 1];
+  response->command[2] = '\0';
+  response->status = ResponseResult(frame[0], frame[offset + 2]);
+  response->value_length = length - (offset + 3);
+  response->value = ((response->value_length > 0) ? &frame[offset + 3] : NULL);
+  
+  return true;
+}
+
+//-------------------------------------------------------------------------------------------------
+
+// Decode an integer value (MSB first, up to 4 bytes - e.g. DB, CH, ID, VR, HV, SH or SL)
+//    (returns FALSE if invalid length)
+boolean XBeeMessages::DecodeInteger(byte* value, int length, unsigned long* number){
+  if((value == NULL) || (length < 1) || (length > 4))
+    return false;
+  
+  *number = 0;
+  for(int i=0 ; i < length ; i++)
+    *number = (*number << 8) | value[i];
+  
+  return true;
+}
+
+//-------------------------------------------------------------------------------------------------
+
+// Decode the first IO sample (value of IS or data of the RX IO frames 0x82 and 0x83)
+//    (returns FALSE if invalid length)
+//    NOTE: format is the number of samples, the channel indicator (2 bytes), the DIO (2 bytes,
+//          if any enabled) and the ADC (2 bytes for each enabled)
+boolean XBeeMessages::DecodeIOSample(byte* value, int length, XBeeIOSample* sample){
+  if((value == NULL) || (length < 3) || (value[0] == 0))
+    return false;
+  
+  word indicator = (value[1] << 8) | value[2];
+  sample->digital_mask = indicator & 0x01FF;
+  sample->analog_mask = (indicator >> 9) & 0x3F;
+  
+  int offset = 3;
+  sample->digital = 0;
+  if(sample->digital_mask != 0){
+    if(length < (offset + 2))
+      return false;
+    sample->digital = ((value[offset] << 8) | value[offset + 1]) & sample->digital_mask;
+    offset += 2;
+  }
+  for(byte i=0 ; i < 6 ; i++){
+    sample->analog[i] = 0;
+    if(sample->analog_mask & (1 << i)){
+      if(length < (offset + 2))
+        return false;
+      sample->analog[i] = ((value[offset] << 8) | value[offset + 1]) & 0x03FF;
+      offset += 2;
+    }
+  }
+  
+  return true;
+}
+
+//-------------------------------------------------------------------------------------------------
+
+// Decode a record of the node discovery (value of ND)
+//    (returns FALSE if invalid length)
+//    NOTE: format is MY (2 bytes), SH (4 bytes), SL (4 bytes), the RSSI and NI ('\0' terminated)
+boolean XBeeMessages::DecodeNodeRecord(byte* value, int length, XBeeNodeRecord* record){
+  if((value == NULL) || (length < 11))
+    return false;
+  
+  record->address_16bit = (value[0] << 8) | value[1];
+  for(int i=0 ; i < 8 ; i++)
+    record->address_64bit[i] = value[2 + i];
+  record->rssi = value[10];
+  
+  int i;
+  for(i=0 ; (i < 20) && ((11 + i) < length) && (value[11 + i] != '\0') ; i++)
+    record->identifier[i] = value[11 + i];
+  record->identifier[i] = '\0';
+  
+  return true;
+}
+
+//-------------------------------------------------------------------------------------------------
+
+// Get the result given the status byte of a response (AT, Remote AT or TX status)
+//    (returns 1 if OK, 10 if error, 11 if invalid command, 12 if invalid parameter,
+//      40 if no response (or no ACK), 41 if CCA failure, 42 if purged)
+//    NOTE: the same results as the requests (XBEE_REQUEST_*), see XBeeMaster::RequestStatus()
+byte XBeeMessages::ResponseResult(byte api_identifier, byte status){
+  if(api_identifier == API_TX_STATUS){
+    switch(status){
+      case 0: return 1;
+      case 1: return XBEE_REQUEST_NO_RESPONSE;
+      case 2: return XBEE_REQUEST_CCA_FAILURE;
+      case 3: return XBEE_REQUEST_PURGED;
+    }
+  } else {
+    switch(status){
+      case 0: return 1;
+      case 1: return XBEE_REQUEST_ERROR;
+      case 2: return XBEE_REQUEST_INVALID_COMMAND;
+      case 3: return XBEE_REQUEST_INVALID_PARAMETER;
+      case 4: return XBEE_REQUEST_NO_RESPONSE;
+    }
+  }
+  return XBEE_REQUEST_ERROR;
+}
+
+//-------------------------------------------------------------------------------------------------
+
+// Implemented (3):
+//    - API_AT_COMMAND
+//    - API_AT_COMMAND_QUEUE
+//    - API_REMOTE_AR_COMMAND_REQUEST
+
+// Validate the response of a given message
+//  (returns 1 if OK, 10 if error, 11 if invalid command, 12 if invalid parameter, 40 if no response, 0 if invalid response)
+//  !!! 'response' in HEX format
+byte XBeeMessages::ResponseStatus(byte sent_message_type, char* response){
+  ByteArray temp;
+  InitializeByteArray(&temp);
+  HexStringToByteArray(response, &temp);
+  
+  byte res = ResponseStatus(sent_message_type, &temp);
+  FreeByteArray(&temp);
+  
+  return res;
+}
+
+
+// Validate the response of a given message
+//  (returns 1 if OK, 10 if error, 11 if invalid command, 12 if invalid parameter, 40 if no response, 0 if invalid response)
+//    NOTE: the response can have data (see DecodeATResponse() to get it)
+byte XBeeMessages::ResponseStatus(byte sent_message_type, ByteArray* barray){
+  byte res = 0;
+  XBeeATResponse response;
+  
+  switch(sent_message_type){
+    case API_AT_COMMAND:
+    case API_AT_COMMAND_QUEUE:
+      if(DecodeATResponse(barray, &response) && (response.api_identifier == API_AT_COMMAND_RESPONSE))
+        res = response.status;
+      break;
+    
+    case API_REMOTE_AT_COMMAND_REQUEST:
+      if(DecodeATResponse(barray, &response) && (response.api_identifier == API_REMOTE_COMMAND_RESPONSE))
+        res = response.status;
+      break;
+    
+    default:
+      XBEE_TRACE(XBEE_TRACE_INVALID_TYPE, sent_message_type, 0, 0); //type not yet implemented
+      break; //must have for when XBEE_API_DEBUG ISN'T defined
+  }
+  
+  return res;
+}
+
+
+// Validate the response of a given message
+//  (returns 1 if OK, 10 if error, 11 if invalid command, 12 if invalid parameter, 40 if no response, 0 if invalid response)
+byte XBeeMessages::ResponseStatus(byte sent_message_type, XBeeFrame* frame){
+  ByteArray temp; //points to the data of the frame, DO NOT free
+  temp.ptr = frame->GetData();
+  temp.length = frame->GetDataLength();
+  
+  return ResponseStatus(sent_message_type, &temp);
+}
+
+//-------------------------------------------------------------------------------------------------
+//-------------------------------------------------------------------------------------------------
+//-------------------------------------------------------------------------------------------------
+
+// Constructor
+XBeeFrame::XBeeFrame(void){
+  _ptr = _inline;
+  _heap = NULL;
+  Clear();
+}
+
+//-------------------------------------------------------------------------------------------------
+
+// Destructor
+XBeeFrame::~XBeeFrame(void){
+  Clear(); //release the storage
+}
+
+//-------------------------------------------------------------------------------------------------
+
+// Append a byte to the data
+//    (returns FALSE if the frame is full)
+boolean XBeeFrame::Append(byte value){
+  if(!Reserve(_length + 1))
+    return false;
+  
+  _ptr[3 + _length] = value;
+  _length++;
+  _sum += value;
+  Update();
+  return true;
+}
+
+
+// Append bytes to the data
+//    (returns FALSE if the frame is full, nothing is appended)
+boolean XBeeFrame::Append(byte* data, int length){
+  if(!Reserve(_length + length))
+    return false;
+  
+  for(int i=0 ; i < length ; i++){
+    _ptr[3 + _length + i] = data[i];
+    _sum += data[i];
+  }
+  _length += length;
+  Update();
+  return true;
+}
+
+//-------------------------------------------------------------------------------------------------
+
+// Append the bytes of a HEX string to the data
+//    (returns FALSE if invalid string or if the frame is full, nothing is appended)
+//  !!! 'hex' in HEX format
+boolean XBeeFrame::AppendHex(char* hex){
+  int length = StrLength(hex);
+  if((length % 2) != 0)
+    return false;
+  if(!Reserve(_length + (length / 2)))
+    return false;
+  
+  //check first
+  for(int i=0 ; i < length ; i++){
+    if(XBeeMaster::HexDigit(hex[i]) < 0)
+      return false;
+  }
+  
+  for(int i=0 ; i < length ; i += 2){
+    byte value = (XBeeMaster::HexDigit(hex[i]) << 4) | XBeeMaster::HexDigit(hex[i + 1]);
+    _ptr[3 + _length] = value;
+    _length++;
+    _sum += value;
+  }
+  Update();
+  return true;
+}
+
+//-------------------------------------------------------------------------------------------------
+
+// Clear the frame (the storage is released)
+void XBeeFrame::Clear(void){
+  if(_heap != NULL){
+#ifdef XBEE_USE_FRAME_POOL
+    XBeeFramePool::Release(_heap);
+#elif defined(USE_POINTER_LIST)
+    Mfree(_heap);
+#else
+    free(_heap);
+#endif
+    _heap = NULL;
+  }
+  _ptr = _inline;
+  
+  _length = 0;
+  _sum = 0;
+  _ptr[0] = FRAME_DELIMITER;
+  Update();
+}
+
+//-------------------------------------------------------------------------------------------------
+
+// Get the API identifier of the frame
+//    (returns 0 if empty)
+byte XBeeFrame::GetAPIIdentifier(void){
+  if(_length == 0)
+    return 0;
+  
+  return _ptr[3];
+}
+
+//-------------------------------------------------------------------------------------------------
+
+// Get the whole frame (Frame, Length_H, Length_L, the data and the CheckSum)
+//    NOTE: valid until the frame is changed
+byte* XBeeFrame::GetBytes(void){
+  return _ptr;
+}
+
+//-------------------------------------------------------------------------------------------------
+
+// Get the data of the frame (starting with the API identifier, without the CheckSum)
+//    NOTE: valid until the frame is changed
+byte* XBeeFrame::GetData(void){
+  return &_ptr[3];
+}
+
+//-------------------------------------------------------------------------------------------------
+
+// Get the length of the data of the frame
+int XBeeFrame::GetDataLength(void){
+  return _length;
 }
 
 //-------------------------------------------------------------------------------------------------
 
-// Send the message
-boolean XBeeMaster::Send(void){
-  if(!_initialized)
-    return false;
-  
-  if(_barray.length <= 0)
-    return false;
+// Get the frame ID
+//    (returns 0 if the API identifier has no frame ID)
+byte XBeeFrame::GetFrameID(void){
+  if((_length < 2) || !HasFrameID(_ptr[3]))
+    return 0;
   
-  //send data
-  for(int i=0 ; i < _barray.length ; i++){
-    _xbee->write(_barray.ptr[i]);
-  }
-  delay(10);
+  return _ptr[4];
+}
+
+//-------------------------------------------------------------------------------------------------
+
+// Get the length of the whole frame
+int XBeeFrame::GetLength(void){
+  return (_length + 4);
+}
+
+//-------------------------------------------------------------------------------------------------
+
+// Get the payload of the frame (the data after the header of the API identifier, e.g. the RF data or the value of an AT command)
+//    NOTE: valid until the frame is changed
+byte* XBeeFrame::GetPayload(void){
+  int offset = PayloadOffset(GetAPIIdentifier());
+  if(offset > _length)
+    offset = _length;
   
-  FreeByteArray(&_barray); //free memory
+  return &_ptr[3 + offset];
+}
+
+//-------------------------------------------------------------------------------------------------
+
+// Get the length of the payload of the frame
+int XBeeFrame::GetPayloadLength(void){
+  int offset = PayloadOffset(GetAPIIdentifier());
+  if(offset > _length)
+    return 0;
   
-  return true;
+  return (_length - offset);
 }
 
 //-------------------------------------------------------------------------------------------------
 
-// Set the computer serial
-boolean XBeeMaster::SetComputer(HardwareSerial* computer){
-  boolean res = false;
-  if(_initialized){
-    if((word)computer != (word)_xbee){ //assign only if not used by XBee (because both are pointers, cast to word to compare even for different types)
-      _computer = computer;
-      _computer->begin(BAUDRATE_PC);
-      _use_computer = true;
-      res = true;
-    }
+// Check if the frames of an API identifier have a frame ID
+boolean XBeeFrame::HasFrameID(byte api_identifier){
+  switch(api_identifier){
+    case API_TX_RESQUEST_64_BIT:
+    case API_TX_RESQUEST_16_BIT:
+    case API_AT_COMMAND:
+    case API_AT_COMMAND_QUEUE:
+    case API_REMOTE_AT_COMMAND_REQUEST:
+    case API_AT_COMMAND_RESPONSE:
+    case API_TX_STATUS:
+    case API_REMOTE_COMMAND_RESPONSE:
+      return true;
   }
-  return res;
+  return false;
 }
 
 //-------------------------------------------------------------------------------------------------
 
-// Set the XBee network Channel variable
-//  (returns TRUE if changed successfully)
-//    NOTE: range is defined for both XBee and XBee PRO
-boolean XBeeMaster::SetNetworkChannel(byte channel){
-  boolean res = false;
-  if(_initialized){
-    if((channel >= 0x0C) && (channel <= 0x17)){ //XBee: 0x0B to 0x1A || XBee PRO: 0x0C to 0x17
-      _network_channel = channel;
-      res = true;
-    }
+// Get the offset of the payload in the data of an API identifier
+byte XBeeFrame::PayloadOffset(byte api_identifier){
+  switch(api_identifier){
+    case API_TX_RESQUEST_64_BIT: return 11; //API identifier, frame ID, address (8) and options
+    case API_TX_RESQUEST_16_BIT: return 5; //API identifier, frame ID, address (2) and options
+    case API_AT_COMMAND:
+    case API_AT_COMMAND_QUEUE: return 4; //API identifier, frame ID and command (2)
+    case API_REMOTE_AT_COMMAND_REQUEST: return 15; //API identifier, frame ID, addresses (8 + 2), options and command (2)
+    case API_RX_64_BIT:
+    case API_RX_64_BIT_IO: return 11; //API identifier, address (8), RSSI and options
+    case API_RX_16_BIT:
+    case API_RX_16_BIT_IO: return 5; //API identifier, address (2), RSSI and options
+    case API_AT_COMMAND_RESPONSE: return 5; //API identifier, frame ID, command (2) and status
+    case API_TX_STATUS: return 3; //API identifier, frame ID and status
+    case API_REMOTE_COMMAND_RESPONSE: return 15; //API identifier, frame ID, addresses (8 + 2), command (2) and status
   }
-  
-  return res;
+  return 1; //API identifier
 }
 
 //-------------------------------------------------------------------------------------------------
 
-// Set the XBee network ID variable
-//  (returns FALSE if not initialized)
-boolean XBeeMaster::SetNetworkID(word id){
-  if(!_initialized)
+// Reserve the storage for the data
+//    (returns FALSE if too long)
+//    NOTE: the frames bigger than XBEE_FRAME_INLINE_SIZE are moved to the heap (or to a slot of the pool)
+boolean XBeeFrame::Reserve(int length){
+  length += 4; //Frame, Length_H, Length_L and CheckSum
+  if(length <= ((_heap == NULL) ? XBEE_FRAME_INLINE_SIZE : XBEE_POOL_SLOT_SIZE))
+    return true;
+  if((_heap != NULL) || (length > XBEE_POOL_SLOT_SIZE))
     return false;
   
-  _network_id = id;
+#ifdef XBEE_USE_FRAME_POOL
+  _heap = XBeeFramePool::Allocate();
+#elif defined(USE_POINTER_LIST)
+  _heap = (byte*)Mmalloc(XBEE_POOL_SLOT_SIZE);
+#else
+  _heap = (byte*)malloc(XBEE_POOL_SLOT_SIZE);
+#endif
+  if(_heap == NULL)
+    return false;
+  
+  memcpy(_heap, _inline, _length + 4);
+  _ptr = _heap;
   return true;
 }
 
 //-------------------------------------------------------------------------------------------------
 
-// Unset the computer serial
-//  (returns FALSE if not initialized)
-boolean XBeeMaster::UnsetComputer(void){
-  if(!_initialized)
+// Set the frame ID
+//    (returns FALSE if the API identifier has no frame ID)
+boolean XBeeFrame::SetFrameID(byte frame_id){
+  if((_length < 2) || !HasFrameID(_ptr[3]))
     return false;
   
-  _computer->end(); //end communication
-  _computer = NULL;
-  _use_computer = false; //reset
+  _sum += frame_id - _ptr[4];
+  _ptr[4] = frame_id;
+  Update();
   return true;
 }
 
+//-------------------------------------------------------------------------------------------------
+
+// Take over a frame (the source is left empty)
+//    NOTE: the storage in the heap (or in the pool) is handed over, only the frames inside are copied
+void XBeeFrame::Take(XBeeFrame* frame){
+  if(frame == this)
+    return;
+  
+  Clear();
+  if(frame->_heap != NULL){
+    _heap = frame->_heap;
+    _ptr = _heap;
+    frame->_heap = NULL; //don't release
+  } else {
+    memcpy(_inline, frame->_inline, frame->_length + 4);
+  }
+  _length = frame->_length;
+  _sum = frame->_sum;
+  
+  frame->Clear();
+}
+
+//-------------------------------------------------------------------------------------------------
+
+// Update the length and the CheckSum
+void XBeeFrame::Update(void){
+  _ptr[1] = (_length >> 8) & 0xFF;
+  _ptr[2] = _length & 0xFF;
+  _ptr[3 + _length] = 0xFF - _sum;
+}
+
 //-------------------------------------------------------------------------------------------------
 //-------------------------------------------------------------------------------------------------
 //-------------------------------------------------------------------------------------------------
 
-// Create message to send a remote AT command
-//    (returns the string to pass to the XBee)
-//    NOTE: if the 16bit_address is invalid or the destination address, the mode is overridden to BROADCAST
-//  !!! ALL strings in HEX format, EXCEPT for 'command_name'
-boolean XBeeMessages::CreateRemoteATRequest(ByteArray* barray_ptr, char* destination_address_64bit, char* destination_address_16bit, byte transmission_type, char* command_name, char* command_values){
-  //free if exists
-  if(barray_ptr->ptr != NULL)
-    FreeByteArray(barray_ptr);
+#ifdef XBEE_USE_FRAME_POOL
+
+byte XBeeFramePool::_slots[XBEE_POOL_SLOTS][XBEE_POOL_SLOT_SIZE];
+byte XBeeFramePool::_free[XBEE_POOL_SLOTS];
+byte XBeeFramePool::_num_free = 0;
+byte XBeeFramePool::_num_used = 0;
+
+//-------------------------------------------------------------------------------------------------
+
+// Allocate a slot
+//    (returns NULL if none is available)
+//    NOTE: the free slots are reused first, then the ones never used (in order)
+byte* XBeeFramePool::Allocate(void){
+  if(_num_free > 0){
+    _num_free--;
+    return _slots[_free[_num_free]];
+  }
   
-  //check if valid command
-  if(StrLength(command_name) != 2) //not hex string
+  if(_num_used < XBEE_POOL_SLOTS){
+    _num_used++;
+    return _slots[_num_used - 1];
+  }
+  
+  return NULL;
+}
+
+//-------------------------------------------------------------------------------------------------
+
+// Get the maximum number of slots used at the same time
+//    NOTE: a slot is used for the first time only when all the others are allocated
+byte XBeeFramePool::GetHighWaterMark(void){
+  return _num_used;
+}
+
+//-------------------------------------------------------------------------------------------------
+
+// Get the number of allocated slots
+byte XBeeFramePool::GetInUse(void){
+  return (_num_used - _num_free);
+}
+
+//-------------------------------------------------------------------------------------------------
+
+// Release a slot
+//    NOTE: NULL is ignored
+void XBeeFramePool::Release(byte* ptr){
+  if(ptr == NULL)
+    return;
+  
+  _free[_num_free] = (ptr - _slots[0]) / XBEE_POOL_SLOT_SIZE;
+  _num_free++;
+}
+
+#endif // XBEE_USE_FRAME_POOL
+
+//-------------------------------------------------------------------------------------------------
+//-------------------------------------------------------------------------------------------------
+//-------------------------------------------------------------------------------------------------
+
+// Check a profile (header, records and checksum)
+//    (returns FALSE if invalid)
+boolean XBeeProfile::Check(ByteArray* profile){
+  if((profile->ptr == NULL) || (profile->length < (XBEE_PROFILE_HEADER + 1)))
     return false;
   
-  //check if there are values
-  if(StrLength(command_values) <= 0)
+  byte* ptr = profile->ptr;
+  word length = (ptr[2] << 8) | ptr[3];
+  if((ptr[0] != XBEE_PROFILE_MARK) || (ptr[1] != XBEE_PROFILE_VERSION) || (profile->length != (XBEE_PROFILE_HEADER + length + 1)))
     return false;
   
-  //resize and store constant values
-  ResizeByteArray(barray_ptr, 15);
-  barray_ptr->ptr[0] = API_REMOTE_AT_COMMAND_REQUEST;
-  barray_ptr->ptr[1] = 0x05; //change here to have a response
+  //records
+  int end = XBEE_PROFILE_HEADER + length;
+  int offset = XBEE_PROFILE_HEADER;
+  byte sum = 0;
+  while(offset < end){
+    if((offset + 3) > end)
+      return false;
+    offset += 3 + ptr[offset + 2];
+  }
+  if(offset != end)
+    return false;
   
-  //store addresses
-  ByteArray temp64;
-  InitializeByteArray(&temp64);
-  HexStringToByteArray(destination_address_64bit, &temp64); //convert data
-  if(temp64.length == 8){
-    for(int i=0 ; i < 8 ; i++)
-      barray_ptr->ptr[2+i] = temp64.ptr[i];
-    switch(transmission_type){
-      case USE_64_BIT_ADDRESS:
-                barray_ptr->ptr[10] = 0xFF;
-                barray_ptr->ptr[11] = 0xFE;
-                break;
-      case USE_16_BIT_ADDRESS:
-                ByteArray temp16;
-                InitializeByteArray(&temp16);
-                HexStringToByteArray(destination_address_16bit, &temp16); //convert data
-                if(temp16.length == 2){
-                  barray_ptr->ptr[10] = temp16.ptr[0];
-                  barray_ptr->ptr[11] = temp16.ptr[1];
-                } else { //broadcast
-                  barray_ptr->ptr[10] = 0xFF;
-                  barray_ptr->ptr[11] = 0xFF;
-                }
-                FreeByteArray(&temp16);
-                break;
-      default: //broadcast
-                barray_ptr->ptr[10] = 0xFF;
-                barray_ptr->ptr[11] = 0xFF;
-                break;
+  //checksum (same as the frames)
+  for(int i=XBEE_PROFILE_HEADER ; i < end ; i++)
+    sum += ptr[i];
+  return ((byte)(0xFF - sum) == ptr[end]);
+}
+
+//-------------------------------------------------------------------------------------------------
+
+// Load a profile from a stream (e.g. a file sent by the computer)
+//    (returns FALSE if invalid profile or if the stream ended before the profile)
+//    NOTE: waits up to LISTEN_TIMEOUT for each byte
+boolean XBeeProfile::Load(Stream* input, ByteArray* profile){
+  FreeByteArray(profile);
+  
+  //header
+  ResizeByteArray(profile, XBEE_PROFILE_HEADER);
+  for(byte i=0 ; i < XBEE_PROFILE_HEADER ; i++){
+    int c = Read(input);
+    if(c < 0){
+      FreeByteArray(profile);
+      return false;
     }
-  } else {
-    for(int i=0 ; i < 8 ; i++)
-      barray_ptr->ptr[2+i] = 0;
-    barray_ptr->ptr[10] = 0xFF; //broadcast
-    barray_ptr->ptr[11] = 0xFF; //broadcast
+    profile->ptr[i] = c;
+  }
+  if((profile->ptr[0] != XBEE_PROFILE_MARK) || (profile->ptr[1] != XBEE_PROFILE_VERSION)){
+    FreeByteArray(profile);
+    return false;
   }
-  FreeByteArray(&temp64);
   
-  barray_ptr->ptr[12] = 0x02; //apply changes
+  //records and checksum
+  word length = (profile->ptr[2] << 8) | profile->ptr[3];
+  ResizeByteArray(profile, XBEE_PROFILE_HEADER + length + 1);
+  for(int i=XBEE_PROFILE_HEADER ; i < profile->length ; i++){
+    int c = Read(input);
+    if(c < 0){
+      FreeByteArray(profile);
+      return false;
+    }
+    profile->ptr[i] = c;
+  }
   
-  //store command
-  ByteArray temp_command;
-  InitializeByteArray(&temp_command);
-  StringToByteArray(command_name, &temp_command); //convert data (NOT HEX string)
-  barray_ptr->ptr[13] = temp_command.ptr[0];
-  barray_ptr->ptr[14] = temp_command.ptr[1];
-  FreeByteArray(&temp_command);
+  if(!Check(profile)){
+    FreeByteArray(profile);
+    return false;
+  }
+  return true;
+}
 
-  //add values
-  HexStringToByteArray(command_values, &temp_command);
-  JoinByteArray(barray_ptr, &temp_command);
-  FreeByteArray(&temp_command);
+//-------------------------------------------------------------------------------------------------
+
+#if defined(__AVR__)
+// Load a profile from the EEPROM
+//    (returns FALSE if no valid profile at the address)
+boolean XBeeProfile::Load(int eeprom_address, ByteArray* profile){
+  FreeByteArray(profile);
+  
+  if((eeprom_address < 0) || ((eeprom_address + XBEE_PROFILE_HEADER) > (E2END + 1)))
+    return false;
+  
+  const uint8_t* address = (const uint8_t*)eeprom_address;
+  if((eeprom_read_byte(address) != XBEE_PROFILE_MARK) || (eeprom_read_byte(address + 1) != XBEE_PROFILE_VERSION))
+    return false;
+  word length = (eeprom_read_byte(address + 2) << 8) | eeprom_read_byte(address + 3);
+  if(((long)eeprom_address + XBEE_PROFILE_HEADER + length + 1) > (E2END + 1))
+    return false;
   
+  ResizeByteArray(profile, XBEE_PROFILE_HEADER + length + 1);
+  for(int i=0 ; i < profile->length ; i++)
+    profile->ptr[i] = eeprom_read_byte(address + i);
+  
+  if(!Check(profile)){
+    FreeByteArray(profile);
+    return false;
+  }
   return true;
 }
 
 //-------------------------------------------------------------------------------------------------
+#endif // __AVR__
+
+// Read a byte of a stream
+//    (returns -1 if nothing was received for LISTEN_TIMEOUT)
+int XBeeProfile::Read(Stream* input){
+  unsigned long start = millis();
+  int c = input->read();
+  while((c < 0) && ((millis() - start) < LISTEN_TIMEOUT))
+    c = input->read();
+  
+  return c;
+}
+
+//-------------------------------------------------------------------------------------------------
+
+// Save a profile in a stream (e.g. a file in the computer)
+//    (returns FALSE if invalid profile)
+boolean XBeeProfile::Save(Print* output, ByteArray* profile){
+  if(!Check(profile))
+    return false;
+  
+  output->write(profile->ptr, profile->length);
+  return true;
+}
 
-// Implemented (1):
-//    - API_REMOTE_AR_COMMAND_REQUEST (doesn't validade response data)
+//-------------------------------------------------------------------------------------------------
 
-// Validate the response of a given message
-//  (returns 1 if OK, 10 if error, 40 if no response)
-byte XBeeMessages::ResponseStatus(byte sent_message_type, char* response){
-  byte res = 0;
-  char* temp = "##";
+#if defined(__AVR__)
+// Save a profile in the EEPROM
+//    (returns FALSE if invalid profile or if it doesn't fit)
+//    NOTE: only the bytes that changed are written (to spare the EEPROM)
+boolean XBeeProfile::Save(int eeprom_address, ByteArray* profile){
+  if(!Check(profile))
+    return false;
   
-  switch(sent_message_type){
-    case API_REMOTE_AT_COMMAND_REQUEST: {
-      //check if correct response identifier
-      temp[0] = response[0];
-      temp[1] = response[1];
-      if(HexCharToByte(temp) != API_REMOTE_COMMAND_RESPONSE)
-        break;
-      //check response
-      temp[0] = response[28];
-      temp[1] = response[29];
-      //check the status
-      byte status = HexCharToByte(temp);
-      switch(status){
-        case 0: res = 1;  break;
-        case 1: res = 10; break;
-        case 4: res = 40; break;
-      }
-      break;
-    }
-    
-    default:
+  if((eeprom_address < 0) || (((long)eeprom_address + profile->length) > (E2END + 1)))
+    return false;
+  
+  uint8_t* address = (uint8_t*)eeprom_address;
+  for(int i=0 ; i < profile->length ; i++){
+    if(eeprom_read_byte(address + i) != profile->ptr[i])
+      eeprom_write_byte(address + i, profile->ptr[i]);
+  }
+  return true;
+}
+
+//-------------------------------------------------------------------------------------------------
+#endif // __AVR__
+
+//-------------------------------------------------------------------------------------------------
+//-------------------------------------------------------------------------------------------------
+//-------------------------------------------------------------------------------------------------
+
 #ifdef XBEE_API_DEBUG
-      Serial.println("ERROR in ResponseStatus: type not yet implemented!");
-#endif
-      break; //must have for when XBEE_API_DEBUG ISN'T defined
+
+XBeeTraceRecord XBeeTrace::_records[XBEE_TRACE_SIZE];
+byte XBeeTrace::_first = 0;
+byte XBeeTrace::_count = 0;
+byte XBeeTrace::_lost = 0;
+
+//-------------------------------------------------------------------------------------------------
+
+// Clear the trace
+void XBeeTrace::Clear(void){
+  _first = 0;
+  _count = 0;
+  _lost = 0;
+}
+
+//-------------------------------------------------------------------------------------------------
+
+// Write the trace in binary format and clear it (decode with extras/xbee_trace_decode.py)
+//    (returns the number of records written)
+//    NOTE: format is 'XBT', number of records, number of lost records, then 8 bytes per record
+//          (time in microseconds (LSB first), event, 3 arguments)
+//    NOTE: call when the time isn't critical (blocks while the output is busy)
+byte XBeeTrace::Dump(Print* output){
+  byte count = _count;
+  
+  output->write((const uint8_t*)"XBT", 3);
+  output->write(count);
+  output->write(_lost);
+  for(byte i=0 ; i < count ; i++){
+    XBeeTraceRecord* record = &_records[(_first + i) % XBEE_TRACE_SIZE];
+    output->write((byte)(record->time & 0xFF));
+    output->write((byte)((record->time >> 8) & 0xFF));
+    output->write((byte)((record->time >> 16) & 0xFF));
+    output->write((byte)((record->time >> 24) & 0xFF));
+    output->write(record->event);
+    output->write(record->args, 3);
   }
   
-  return res;
+  Clear();
+  return count;
 }
 
+//-------------------------------------------------------------------------------------------------
 
-// Validate the response of a given message
-//  (returns 1 if OK, 10 if error, 40 if no response)
-byte XBeeMessages::ResponseStatus(byte sent_message_type, ByteArray* barray){
-  byte res = 0;
-  
-  switch(sent_message_type){
-    case API_REMOTE_AT_COMMAND_REQUEST:
-      //check length
-      if(barray->length != 15)
-        break;
-      //check if correct response identifier
-      if(barray->ptr[0] != API_REMOTE_COMMAND_RESPONSE)
-        break;
-      //check response
-      switch(barray->ptr[14]){
-        case 0: res = 1;  break;
-        case 1: res = 10; break;
-        case 4: res = 40; break;
-      }
-      break;
-    
-    default:
-#ifdef XBEE_API_DEBUG
-      Serial.println("ERROR in ResponseStatus: type not yet implemented!");
-#endif
-      break; //must have for when XBEE_API_DEBUG ISN'T defined
+// Record an event
+//    NOTE: when the trace is full, the oldest record is lost
+void XBeeTrace::Record(byte event, byte arg0, byte arg1, byte arg2){
+  XBeeTraceRecord* record;
+  if(_count < XBEE_TRACE_SIZE){
+    record = &_records[(_first + _count) % XBEE_TRACE_SIZE];
+    _count++;
+  } else {
+    record = &_records[_first]; //overwrite the oldest
+    _first = (_first + 1) % XBEE_TRACE_SIZE;
+    if(_lost < 0xFF)
+      _lost++;
   }
   
-  return res;
+  record->time = micros();
+  record->event = event;
+  record->args[0] = arg0;
+  record->args[1] = arg1;
+  record->args[2] = arg2;
 }
 
+#endif // XBEE_API_DEBUG
+
 //-------------------------------------------------------------------------------------------------
 
 
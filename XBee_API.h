@@ -34,6 +34,11 @@
         library in Arduino versions 0022 and 0023, but
         is disabled by default.
 
+  NOTE: with XBEE_API_DEBUG defined, the events are
+        recorded in RAM by XBeeTrace, to be written
+        with XBeeTrace::Dump() and decoded with
+        extras/xbee_trace_decode.py
+
   NOTES for versions:
 	. Configure functions are general, they only change
 	  the network ID, Channel and Baudrate. The only
@@ -48,6 +53,26 @@
 //#define USE_SOFTWARE_SERIAL //comment to use the XBee in a HardwareSerial port
         // !!! the software serial sends the message, but does not listen to the response (tested with bd=19200)
 
+//#define XBEE_USE_FRAME_POOL //uncomment to store the frames in a static pool instead of the heap (see XBeeFramePool)
+
+#define XBEE_API_DEBUG //comment to disable the trace of the events (see XBeeTrace)
+
+//#define XBEE_API_STATS //uncomment to count the frames, errors and round trip times (see XBeeStats)
+
+//#define XBEE_API_CAPTURE //uncomment to record the raw frames and replay them (see XBeeMaster::SetCapture())
+
+//#define XBEE_USE_FRAGMENTS //uncomment to send and receive messages bigger than a frame (see XBeeMaster::SendMessage())
+
+//#define XBEE_USE_NODE_QUEUE //uncomment to hold the requests to sleeping nodes until they wake up (see XBeeMaster::SetSleepingNode())
+
+//#define XBEE_USE_PACING //uncomment to pace the sent frames by the responses, the CTS and the drain rate (see XBeeMaster::SetCTSPin())
+
+//#define XBEE_USE_LINK_MONITOR //uncomment to keep the statistics of the links and adapt the timeouts of the requests (see XBeeMaster::SetLinkMonitor())
+
+//#define XBEE_USE_TX_QUEUE //uncomment to queue the sent frames by priority, sending them at the frame boundaries (see XBeeMaster::SetPriority())
+
+//#define XBEE_USE_RETRIES //uncomment to send again the TX and Remote AT requests that fail, with exponential backoff and jitter (see XBeeMaster::SetRetryPolicy())
+
 
 #if defined(ARDUINO) && (ARDUINO >= 100)
 #include <Arduino.h> //for Arduino 1.0 or later
@@ -68,6 +93,9 @@
 #include <String_Functions.h>
 #include <Hex_Strings.h> //to manipulate the messages
 #include "XBee_API_ATCommands.h" //the AT commands
+#if defined(__AVR__)
+#include <avr/eeprom.h> //to store the profiles
+#endif
 
 //--------------------------------------
 
@@ -75,10 +103,73 @@
 #define NETWORK_ID 0xA1BA  //0 to 0xFFFF
 #define NETWORK_CHANNEL 0x13 //XBee: 0x0B to 0x1A || XBee PRO: 0x0C to 0x17
 
+//user defined sizes (can also be defined in the compiler flags, e.g. -DXBEE_RX_BUFFER_SIZE=64)
+//    NOTE: the sizes of the frames include the header (Frame, Length_H and Length_L) and the CheckSum,
+//          so the maximum length of the data is (size - 4)
+#ifndef XBEE_RX_BUFFER_SIZE
+#define XBEE_RX_BUFFER_SIZE 150 //frames received by Listen() and Poll()
+#endif
+#ifndef XBEE_TX_BUFFER_SIZE
+#define XBEE_TX_BUFFER_SIZE 150 //frames created by CreateFrame()
+#endif
+#ifndef XBEE_MAX_REQUESTS
+#define XBEE_MAX_REQUESTS 4 //requests waiting for the response at the same time
+#endif
+#ifndef XBEE_POOL_SLOTS
+#define XBEE_POOL_SLOTS 3 //frames in the pool (TX frame, frame received by Poll() and by Listen())
+#endif
+#ifndef XBEE_TRACE_SIZE
+#define XBEE_TRACE_SIZE 16 //records in the trace (8 bytes each)
+#endif
+#ifndef XBEE_TX_WINDOW
+#define XBEE_TX_WINDOW 2 //frames sent waiting for the response at the same time (with XBEE_USE_PACING)
+#endif
+#ifndef XBEE_MAX_NODES
+#define XBEE_MAX_NODES 4 //sleeping nodes
+#endif
+#ifndef XBEE_MAX_HELD
+#define XBEE_MAX_HELD 2 //requests held for each sleeping node, out of XBEE_MAX_REQUESTS (with XBEE_USE_NODE_QUEUE)
+#endif
+#ifndef XBEE_MAX_LINKS
+#define XBEE_MAX_LINKS 4 //nodes with the statistics of the link (with XBEE_USE_LINK_MONITOR)
+#endif
+#ifndef XBEE_TX_QUEUE_SIZE
+#define XBEE_TX_QUEUE_SIZE 4 //frames waiting to be sent (with XBEE_USE_TX_QUEUE)
+#endif
+#ifndef XBEE_FRAME_INLINE_SIZE
+#define XBEE_FRAME_INLINE_SIZE 32 //frames stored inside the XBeeFrame (the bigger ones use the heap or a slot of the pool)
+#endif
+#ifndef XBEE_FRAGMENT_SIZE
+#define XBEE_FRAGMENT_SIZE 95 //data in each fragment (RF payload of 100 bytes minus the header of the fragment)
+#endif
+#ifndef XBEE_FRAGMENT_MAX
+#define XBEE_FRAGMENT_MAX 64 //fragments of a message (multiple of 8)
+#endif
+
 //--------------------------------------
 
 #define LISTEN_TIMEOUT 1000
 
+//the slots of the pool fit the biggest frame
+#if XBEE_TX_BUFFER_SIZE > XBEE_RX_BUFFER_SIZE
+#define XBEE_POOL_SLOT_SIZE XBEE_TX_BUFFER_SIZE
+#else
+#define XBEE_POOL_SLOT_SIZE XBEE_RX_BUFFER_SIZE
+#endif
+
+#if XBEE_FRAME_INLINE_SIZE < 4
+#error "XBee API: the XBeeFrame must fit at least the header and the checksum (4 bytes)"
+#endif
+
+#if (XBEE_RX_BUFFER_SIZE < 20) || (XBEE_TX_BUFFER_SIZE < 20)
+#error "XBee API: the buffers must fit at least the Remote AT Command frames (20 bytes)"
+#endif
+
+//+20 for the header of the TX frame (with 64-bit address), the header of the fragment, Frame, Length_H, Length_L and CheckSum
+#if defined(XBEE_USE_FRAGMENTS) && (((XBEE_FRAGMENT_SIZE + 20) > XBEE_RX_BUFFER_SIZE) || ((XBEE_FRAGMENT_SIZE + 20) > XBEE_TX_BUFFER_SIZE))
+#error "XBee API: the buffers must fit the fragments (XBEE_FRAGMENT_SIZE + 20 bytes)"
+#endif
+
 //--------------------------------------
 
 // Data bytes that need to be escaped
@@ -108,6 +199,138 @@
 #define USE_64_BIT_ADDRESS 0x01
 #define USE_16_BIT_ADDRESS 0x02
 
+// Options of the Remote AT commands
+#define XBEE_REMOTE_QUEUE 0x00 //wait for AC (or WR and AC) to apply the changes
+#define XBEE_REMOTE_APPLY 0x02 //apply the changes
+
+// Jobs (configuration in command mode, advanced by Poll())
+#define XBEE_JOB_BUSY 2 //returned while the job is running
+#define XBEE_JOB_BUFFER_SIZE 24 //fits the batched read of ID, CH, MY, BD and AP
+
+// Request results (besides 1 when succesful)
+#define XBEE_REQUEST_PENDING 2
+#define XBEE_REQUEST_ERROR 10
+#define XBEE_REQUEST_INVALID_COMMAND 11
+#define XBEE_REQUEST_INVALID_PARAMETER 12
+#define XBEE_REQUEST_NO_RESPONSE 40 //no response from the remote XBee (or no ACK)
+#define XBEE_REQUEST_CCA_FAILURE 41
+#define XBEE_REQUEST_PURGED 42
+#define XBEE_REQUEST_TIMEOUT 50
+#define XBEE_REQUEST_CANCELLED 51
+
+// Priorities of the sent frames (see XBEE_USE_TX_QUEUE)
+#define XBEE_PRIORITY_CONTROL 0 //AT and Remote AT commands
+#define XBEE_PRIORITY_NORMAL 1 //data
+#define XBEE_PRIORITY_BULK 2 //fragments
+#define XBEE_PRIORITIES 3
+#define XBEE_PRIORITY_AUTO 0xFF //given by the API identifier
+
+// Classes of the requests sent again (see XBEE_USE_RETRIES)
+#define XBEE_RETRY_TX 0 //TX requests (64-bit and 16-bit)
+#define XBEE_RETRY_REMOTE_AT 1
+#define XBEE_RETRY_CLASSES 2
+
+// Timeout of the requests given by the link with the destination (LISTEN_TIMEOUT without XBEE_USE_LINK_MONITOR)
+#define XBEE_TIMEOUT_AUTO 0
+
+// Frame handlers (indexed by the 5 LSB of the API identifiers 0x80 to 0x9F)
+#define XBEE_HANDLERS 32
+
+// Pacing
+#define XBEE_NO_PIN 0xFF
+
+// Capture
+#define XBEE_CAPTURE_RECORD 0xCA //begin of each record
+
+// Fragments (RF data: mark, kind, message ID, index, count and the data)
+#define XBEE_FRAGMENT_MARK 0xF5
+#define XBEE_FRAGMENT_HEADER 5
+#define XBEE_FRAGMENT_DATA 0
+#define XBEE_FRAGMENT_ACK 1 //message received
+#define XBEE_FRAGMENT_NACK 2 //followed by the bitmap of the fragments to send again
+
+// Profiles (mark, version and length of the records - MSB first, followed by the records and the checksum)
+//    NOTE: each record is the AT command (2 characters), the length of the value and the value
+#define XBEE_PROFILE_MARK 0xB7
+#define XBEE_PROFILE_VERSION 1
+#define XBEE_PROFILE_HEADER 4
+
+// Static frames (the whole frame is built by the compiler and stored in the flash - see XBeeMaster::SendStatic())
+//    NOTE: the frame ID is 0 (no response), the address is given in 8 bytes (MSB first) and the command in 2 characters, e.g.
+//          XBEE_STATIC_REMOTE_AT(LED_ON, 0x00, 0x13, 0xA2, 0x00, 0x40, 0x9F, 0xAA, 0x1A, 'D', '1', 0x05);
+#define XBEE_STATIC_AT(name, c0, c1, value) \
+  const byte name[] PROGMEM = {FRAME_DELIMITER, 0x00, 0x05, API_AT_COMMAND, 0x00, (c0), (c1), (value), \
+                               (byte)(0xFF - ((API_AT_COMMAND + (c0) + (c1) + (value)) & 0xFF))}
+#define XBEE_STATIC_REMOTE_AT(name, a0, a1, a2, a3, a4, a5, a6, a7, c0, c1, value) \
+  const byte name[] PROGMEM = {FRAME_DELIMITER, 0x00, 0x10, API_REMOTE_AT_COMMAND_REQUEST, 0x00, \
+                               (a0), (a1), (a2), (a3), (a4), (a5), (a6), (a7), 0xFF, 0xFE, XBEE_REMOTE_APPLY, (c0), (c1), (value), \
+                               (byte)(0xFF - ((API_REMOTE_AT_COMMAND_REQUEST + (a0) + (a1) + (a2) + (a3) + (a4) + (a5) + (a6) + (a7) + \
+                                               0xFF + 0xFE + XBEE_REMOTE_APPLY + (c0) + (c1) + (value)) & 0xFF))}
+
+// Statistics
+#define XBEE_STATS_API_TYPES 14 //13 API identifiers (see XBeeMaster::StatsIndex()) + others
+#define XBEE_STATS_API_OTHER 13
+#define XBEE_STATS_RTT_TYPES 3
+#define XBEE_STATS_RTT_AT 0
+#define XBEE_STATS_RTT_REMOTE_AT 1
+#define XBEE_STATS_RTT_TX 2
+#define XBEE_STATS_RTT_BUCKETS 8
+#define XBEE_STATS_RTT_LIMITS {10, 20, 50, 100, 200, 500, 1000} //in milliseconds
+
+// Trace events (arguments)
+#define XBEE_TRACE_AT_COMMAND 1 //(command[0], command[1], try number) - '+', '+' for +++
+#define XBEE_TRACE_AT_REPLY 2 //(number of characters, reply[0], reply[1])
+#define XBEE_TRACE_JOB_END 3 //(job, result, -)
+#define XBEE_TRACE_FRAME_TX 4 //(API identifier, frame ID, length LSB)
+#define XBEE_TRACE_FRAME_RX 5 //(API identifier, frame ID, length LSB)
+#define XBEE_TRACE_CHECKSUM_ERROR 6 //(API identifier, -, length LSB)
+#define XBEE_TRACE_REQUEST_END 7 //(handle, result, type)
+#define XBEE_TRACE_INVALID_TYPE 8 //(message type, -, -)
+#define XBEE_TRACE_REQUEST_RETRY 9 //(handle, result, attempt)
+
+//--------------------------------------
+
+// Frame with its own storage (Frame, Length_H, Length_L, the data and the CheckSum, ready to be sent)
+//    NOTE: the length and the CheckSum are updated as the data is appended
+//    NOTE: can't be copied, the frame is handed over with Take() (the source is left empty)
+//    NOTE: the storage is released by the destructor
+class XBeeFrame{
+  
+  public:
+    XBeeFrame(void);
+    ~XBeeFrame(void);
+    boolean Append(byte value);
+    boolean Append(byte* data, int length);
+    boolean AppendHex(char* hex);
+    void Clear(void);
+    byte GetAPIIdentifier(void);
+    byte* GetBytes(void);
+    byte* GetData(void);
+    int GetDataLength(void);
+    byte GetFrameID(void);
+    int GetLength(void);
+    byte* GetPayload(void);
+    int GetPayloadLength(void);
+    boolean SetFrameID(byte frame_id);
+    void Take(XBeeFrame* frame);
+  
+  private:
+    byte* _ptr; //_inline or _heap
+    byte* _heap; //NULL if the frame fits _inline
+    byte _inline[XBEE_FRAME_INLINE_SIZE];
+    int _length; //of the data
+    byte _sum; //of the data
+    
+    XBeeFrame(const XBeeFrame& frame); //not copyable (see Take())
+    XBeeFrame& operator=(const XBeeFrame& frame);
+    static boolean HasFrameID(byte api_identifier);
+    static byte PayloadOffset(byte api_identifier);
+    boolean Reserve(int length);
+    void Update(void);
+  
+  friend class XBeeMaster; //to receive the frames straight in the storage (see XBeeMaster::Listen())
+};
+
 //--------------------------------------
 
 typedef struct{
@@ -115,6 +338,154 @@ typedef struct{
   byte value;
 } XBeePin;
 
+// Callback for the completion of a sent frame (TX status, AT or Remote AT response)
+//    (receives the frame ID and the status byte of the response)
+typedef void (*XBeeSendCallback)(byte frame_id, byte status);
+
+// Handler of the received frames of an API identifier (see XBeeMaster::SetFrameHandler())
+//    (receives the frame without the header and the checksum, starting with the API identifier)
+typedef void (*XBeeFrameHandler)(byte* frame, int length);
+
+// Callback for the completion of a request
+//    (receives the handle and the result of the request)
+typedef void (*XBeeRequestCallback)(byte handle, byte result);
+
+// Request waiting for the response (see XBeeMaster::Poll())
+typedef struct{
+  byte result; //0 if free
+  byte type; //API identifier of the request
+  byte frame_id;
+  byte address[8]; //source of the frame (RX requests) or destination (TX and Remote AT requests)
+  byte address_length;
+  ByteArray* value; //to store the data of the response (can be NULL)
+  unsigned long start_time;
+  unsigned long timeout;
+  unsigned long sent_time; //micros() at the end of the transmission of the frame (for the round trip time)
+#ifdef XBEE_USE_NODE_QUEUE
+  ByteArray frame; //waiting for the destination to wake up (empty if sent)
+#endif
+#ifdef XBEE_USE_RETRIES
+  XBeeFrame sent; //copy to send again (empty if not sent again)
+  byte attempt; //number of the last attempt sent (1 for the first one)
+  byte previous_frame_id; //of the previous attempt (its late success completes the request)
+  boolean waiting; //to be sent again at 'retry_time'
+  unsigned long retry_time;
+#endif
+} XBeeRequest;
+
+// Policy of the retransmissions of a class of requests (see XBeeMaster::SetRetryPolicy())
+typedef struct{
+  byte attempts; //maximum, including the first one (1 to disable)
+  unsigned long backoff; //before the first retransmission, doubled for each one (milliseconds)
+  unsigned long max_backoff;
+} XBeeRetryPolicy;
+
+// Frame sent waiting for the response (see XBEE_USE_PACING)
+typedef struct{
+  byte frame_id; //0 if free
+  byte api_identifier;
+  int length;
+  unsigned long time; //micros() when sent
+} XBeeTXFrame;
+
+// Frame waiting to be sent (see XBEE_USE_TX_QUEUE)
+typedef struct{
+  XBeeFrame frame; //empty if free
+  byte priority;
+  word order; //of the arrival
+} XBeeQueuedFrame;
+
+// Sleeping node (see XBeeMaster::SetSleepingNode())
+typedef struct{
+  byte address[8];
+  byte address_length; //0 if free
+  unsigned long awake_time; //after the last frame received (ST)
+  unsigned long last_time; //of the last frame received
+  unsigned long wake_time; //of the first frame received after sleeping
+  unsigned long period; //between the wake ups (0 if unknown)
+} XBeeNode;
+
+// Statistics of the link with a node (see XBeeMaster::GetLink())
+//    NOTE: the round trip time is smoothed like in TCP (RFC 6298) and the RSSI is in -dBm
+//    NOTE: the round trip time is measured from the end of the transmission to the arrival of the response
+typedef struct{
+  byte address[8];
+  byte address_length; //0 if free
+  byte rssi; //of the frames received from the node (0 if unknown)
+  byte remote_rssi; //of the last frame received by the node - DB (0 if unknown)
+  byte failures; //consecutive requests without response (each one doubles the timeout)
+  word successes; //requests with response
+  word losses; //requests without response
+  unsigned long srtt; //smoothed round trip time in milliseconds
+  unsigned long rttvar; //variation of the round trip time
+  unsigned long last_time; //of the last request
+} XBeeLink;
+
+// Message sent or received in fragments (see XBeeMaster::SendMessage())
+typedef struct{
+  byte result; //0 if free
+  byte message_id;
+  byte count; //number of fragments
+  byte address[8]; //destination or source
+  byte address_length;
+  ByteArray* data;
+  int length; //of the received data
+  byte bitmap[XBEE_FRAGMENT_MAX / 8]; //fragments to send or received
+  byte next; //next fragment to send
+  byte tries;
+  unsigned long time; //of the last fragment
+} XBeeLongMessage;
+
+// Statistics of the link (see XBeeMaster::GetStats())
+//    NOTE: the index of the frames is given by XBeeMaster::StatsIndex() (0x00, 0x01, 0x08, 0x09, 0x17,
+//          0x80, 0x81, 0x82, 0x83, 0x88, 0x89, 0x8A, 0x97, others)
+typedef struct{
+  unsigned long frames_sent[XBEE_STATS_API_TYPES];
+  unsigned long frames_received[XBEE_STATS_API_TYPES];
+  unsigned long checksum_errors; //code 30 of Listen()
+  unsigned long length_errors; //code 20 of Listen()
+  unsigned long overflows; //code 11 of Listen()
+  unsigned long timeouts; //code 10 of Listen(), jobs and requests
+  unsigned long retries; //commands sent again in the jobs, fragments and requests (with XBEE_USE_RETRIES)
+  unsigned long command_mode_entries;
+  word rtt[XBEE_STATS_RTT_TYPES][XBEE_STATS_RTT_BUCKETS]; //histograms of the round trip time of the requests (AT, Remote AT, TX), from the end of the transmission
+} XBeeStats;
+
+// Response of an AT or Remote AT command (see XBeeMessages::DecodeATResponse())
+typedef struct{
+  byte api_identifier; //API_AT_COMMAND_RESPONSE or API_REMOTE_COMMAND_RESPONSE
+  byte frame_id;
+  char command[3]; //e.g. "DB"
+  byte status; //1 if OK, 10 if error, 11 if invalid command, 12 if invalid parameter, 40 if no response
+  byte address_64bit[8]; //source (Remote AT only)
+  word address_16bit; //source (Remote AT only)
+  byte* value; //points to the data of the frame (NOT copied)
+  int value_length; //0 if none
+} XBeeATResponse;
+
+// Record of a node discovery (see XBeeMessages::DecodeNodeRecord())
+typedef struct{
+  word address_16bit; //MY
+  byte address_64bit[8]; //SH and SL
+  byte rssi; //-dBm
+  char identifier[21]; //NI
+} XBeeNodeRecord;
+
+// IO sample (see XBeeMessages::DecodeIOSample())
+typedef struct{
+  word digital_mask; //enabled DIO (bit 0 for D0 to bit 8 for D8)
+  word digital; //levels of the enabled DIO
+  byte analog_mask; //enabled ADC (bit 0 for A0 to bit 5 for A5)
+  word analog[6]; //values of the enabled ADC (10 bits)
+} XBeeIOSample;
+
+// Record of the trace
+typedef struct{
+  unsigned long time; //micros()
+  byte event;
+  byte args[3];
+} XBeeTraceRecord;
+
 //--------------------------------------
 
 class XBeeMaster{
@@ -128,36 +499,213 @@ class XBeeMaster{
 #endif
     ~XBeeMaster(void);
     boolean AssignByteArray(ByteArray* barray);
-    byte ConfigureAsMaster(long baudrate);
-    byte ConfigureAsSlave(long baudrate);
+    void CancelRequest(byte handle);
+    byte ConfigureAsMaster(long baudrate, boolean differential = false);
+    byte ConfigureAsSlave(long baudrate, boolean differential = false);
     byte ConfigurePins(XBeePin *pins, byte num_pins);
     boolean CreateFrame(char* message, boolean is_hex);
     boolean CreateFrame(ByteArray* message);
+    long DetectBaudrate(void);
     void Destroy(void);
+    uint64_t GetAddress(void);
+    boolean GetAddress(byte* address);
+    long GetBaudrate(void);
     byte GetNetworkChannel(void);
     word GetNetworkID(void);
+#ifdef XBEE_USE_FRAGMENTS
+    boolean GetMessage(ByteArray* data, ByteArray* source_address);
+#endif
+#ifdef XBEE_USE_PACING
+    byte GetOutstandingFrames(void);
+#endif
+#ifdef XBEE_USE_TX_QUEUE
+    byte GetQueuedFrames(void);
+#endif
+    word GetFirmwareVersion(void);
+    unsigned long GetFrameTime(void);
+    word GetHardwareVersion(void);
     char* GetSerialNumber(void);
+#ifdef XBEE_USE_NODE_QUEUE
+    unsigned long GetWakePeriod(char* address);
+#endif
+    byte GetProfile(ByteArray* profile);
+#ifdef XBEE_USE_LINK_MONITOR
+    boolean GetLink(char* address, XBeeLink* link);
+    void GetLinkFailures(word* ack_failures, word* cca_failures);
+#endif
+#ifdef XBEE_API_STATS
+    boolean GetStats(XBeeStats* stats);
+#endif
     void Initialize(void);
     void Initialize(HardwareSerial* computer);
+    boolean IsBusy(void);
     int Listen(char** str, boolean free_str, unsigned long timeout = LISTEN_TIMEOUT, unsigned long pause_time = 20);
+    int Listen(XBeeFrame* frame, unsigned long timeout = LISTEN_TIMEOUT, unsigned long pause_time = 20);
+#ifdef XBEE_USE_FRAGMENTS
+    byte MessageStatus(void);
+#endif
+    byte NegotiateBaudrate(long max_baudrate = 115200, boolean write = false);
+    byte Poll(void);
+    unsigned int Process(void);
+#ifdef XBEE_API_CAPTURE
+    unsigned int Replay(Stream* input, boolean realtime);
+#endif
+    byte RequestAT(char* command_name, char* command_values, ByteArray* value, unsigned long timeout = LISTEN_TIMEOUT);
+    byte RequestRemoteAT(char* destination_address_64bit, char* destination_address_16bit, byte transmission_type, char* command_name, char* command_values, ByteArray* value, unsigned long timeout = XBEE_TIMEOUT_AUTO, byte options = XBEE_REMOTE_APPLY);
+    byte RequestRX(char* source_address, ByteArray* data, unsigned long timeout = LISTEN_TIMEOUT);
+    byte RequestStatus(byte handle);
+    byte RequestTX(char* destination_address, byte transmission_type, ByteArray* data, unsigned long timeout = XBEE_TIMEOUT_AUTO);
+#ifdef XBEE_API_STATS
+    void ResetStats(void);
+#endif
     byte Restore(void);
     byte Restore(long baudrate);
+    byte SelectChannel(char** slaves = NULL, byte num_slaves = 0);
+    byte ReadIdentity(unsigned long timeout = LISTEN_TIMEOUT);
     boolean Send(void);
+    boolean Send(XBeeFrame* frame);
+#ifdef XBEE_USE_FRAGMENTS
+    byte SendMessage(char* destination_address, byte transmission_type, ByteArray* data);
+#endif
+    boolean SendStatic(const byte* frame);
+#ifdef XBEE_API_CAPTURE
+    void SetCapture(Print* output, byte port_id = 0);
+#endif
     boolean SetComputer(HardwareSerial* computer);
+    boolean SetFrameHandler(byte api_identifier, XBeeFrameHandler handler);
+#ifdef XBEE_USE_LINK_MONITOR
+    boolean SetLinkMonitor(unsigned long interval, boolean tune_retries = false);
+#endif
+#ifdef XBEE_USE_PACING
+    void SetCTSPin(byte pin);
+#endif
+#ifdef XBEE_USE_TX_QUEUE
+    void SetPriority(byte priority);
+#endif
     boolean SetNetworkChannel(byte channel = NETWORK_CHANNEL);
     boolean SetNetworkID(word id = NETWORK_ID);
+#ifdef XBEE_USE_NODE_QUEUE
+    boolean SetSleepingNode(char* address, unsigned long awake_time);
+#endif
+    byte SetProfile(ByteArray* profile, boolean write = true);
+    void SetRequestCallback(XBeeRequestCallback callback);
+#ifdef XBEE_USE_RETRIES
+    boolean SetRetryPolicy(byte request_class, byte attempts, unsigned long backoff, unsigned long max_backoff);
+#endif
+    void SetSendCallback(XBeeSendCallback callback);
+    byte StartConfigureAsMaster(long baudrate, boolean differential = false);
+    byte StartConfigureAsSlave(long baudrate, boolean differential = false);
+    byte StartConfigurePins(XBeePin *pins, byte num_pins);
+    byte StartRestore(void);
+    byte StartRestore(long baudrate);
     boolean UnsetComputer(void);
+    byte WaitRequest(byte handle);
     
 static long GetPCbaudrate(void);
 static long GetXBeebaudrate(void);
     
   private:
     boolean _initialized;
-    boolean _is_SerialNumber;
     boolean _use_computer;
+    long _baudrate; //of the connection with the XBee
+    //identity (see ReadIdentity())
+    uint64_t _serial_number; //SH and SL (0 if unknown)
+    word _firmware_version; //VR (0 if unknown)
+    word _hardware_version; //HV (0 if unknown)
     byte _network_channel;
     word _network_id;
     ByteArray _barray;
+    XBeeSendCallback _send_callback;
+    //job
+    byte _job;
+    byte _job_result;
+    byte _job_step;
+    byte _job_tries;
+    byte _job_count;
+    boolean _job_waiting;
+    boolean _job_master;
+    boolean _job_differential; //set only the parameters with different values
+    byte _job_diff; //steps to set in the differential configuration (bit of each step)
+    byte _job_bd;
+    XBeePin* _job_pins;
+    byte _job_num_pins;
+    byte _job_pin;
+    unsigned long _job_start;
+    char _job_reply[XBEE_JOB_BUFFER_SIZE];
+    char _job_serial[17]; //16 characters
+    word _job_firmware; //VR
+    word _job_hardware; //HV
+    //requests
+    byte _frame_id;
+    XBeeRequest _requests[XBEE_MAX_REQUESTS];
+    XBeeRequestCallback _request_callback;
+    XBeeFrameHandler _handlers[XBEE_HANDLERS];
+    //channel scan
+    byte* _scan_pans; //PANs found in each channel (NULL if not scanning)
+    boolean _scan_done;
+#ifdef XBEE_USE_FRAGMENTS
+    //messages
+    byte _message_id;
+    XBeeLongMessage _message_tx;
+    XBeeLongMessage _message_rx;
+    ByteArray _message_buffer; //of the received message
+#endif
+#ifdef XBEE_USE_NODE_QUEUE
+    XBeeNode _nodes[XBEE_MAX_NODES];
+    boolean _wake_pending; //a node woke up (see SendHeld())
+#endif
+#ifdef XBEE_USE_PACING
+    //pacing
+    XBeeTXFrame _tx_window[XBEE_TX_WINDOW];
+    unsigned long _tx_drain; //microseconds per byte (measured by the TX status)
+    unsigned long _tx_ready; //micros() to send the next frame without response
+    byte _cts_pin;
+    boolean _handling; //a frame received by Poll() is being handled
+#endif
+#ifdef XBEE_USE_LINK_MONITOR
+    //link monitor
+    XBeeLink _links[XBEE_MAX_LINKS];
+    unsigned long _link_interval; //between the samples (0 if stopped)
+    unsigned long _link_time; //of the last sample
+    byte _link_sample; //index of the node, LINK_SAMPLE_EA, LINK_SAMPLE_EC or LINK_SAMPLE_RR
+    byte _link_handle; //request of the sample (0 if none)
+    ByteArray _link_value; //of the response of the sample
+    boolean _link_tune; //tune the retries (RR)
+    byte _link_retries; //RR
+    word _link_sent; //requests to the nodes since the last sample of EA
+    word _link_ack_failures; //EA
+    word _link_cca_failures; //EC
+#endif
+#ifdef XBEE_USE_TX_QUEUE
+    //transmit queue
+    XBeeQueuedFrame _queue[XBEE_TX_QUEUE_SIZE];
+    word _queue_order; //of the next queued frame
+    byte _queue_passed[XBEE_PRIORITIES]; //times that each priority was passed over by the higher ones
+    byte _queue_priority; //of the next frames (XBEE_PRIORITY_AUTO by the API identifier)
+    unsigned long _queue_free; //micros() when the serial port is drained
+#endif
+#ifdef XBEE_USE_RETRIES
+    //retransmissions
+    XBeeRetryPolicy _retry_policies[XBEE_RETRY_CLASSES];
+    unsigned long _retry_random; //state of the jitter (0 until seeded, see RetryDelay())
+#endif
+#ifdef XBEE_USE_FRAME_POOL
+    byte* _tx_frame;
+    int _tx_length;
+    byte* _rx_buffer;
+#else
+    byte _rx_buffer[XBEE_RX_BUFFER_SIZE];
+#endif
+    int _rx_count;
+    unsigned int _rx_length;
+    unsigned long _rx_time; //micros() when the first byte of the frame was read
+#ifdef XBEE_API_STATS
+    XBeeStats _stats;
+#endif
+#ifdef XBEE_API_CAPTURE
+    Print* _capture;
+    byte _capture_port;
+#endif
     HardwareSerial* _computer; // (Rx, Tx) = (0,1) ~ 9600
 #ifdef USE_SOFTWARE_SERIAL
     SoftwareSerial* _xbee;
@@ -165,19 +713,198 @@ static long GetXBeebaudrate(void);
     HardwareSerial* _xbee; // (Rx, Tx) = (19,18) ~ 19200 (Serial 1 on MEGA)
 #endif
 
+    byte AddRequest(byte type, ByteArray* value, unsigned long timeout);
+    static byte BaudrateIndex(long baudrate);
+    boolean ChangeBaudrate(byte bd);
+#ifdef XBEE_API_CAPTURE
+    void Capture(boolean received, byte* frame, int length);
+#endif
+    boolean CompareJobValues(void);
     byte CheckSum(ByteArray* barray_ptr);
-    byte ConfigureXBee(long baudrate, boolean master);
+    byte CheckSum(byte* ptr, int length);
+    boolean CheckLink(unsigned long timeout);
+#ifdef XBEE_USE_LINK_MONITOR
+    void CheckLinks(void);
+#endif
+#ifdef XBEE_USE_FRAGMENTS
+    void CheckMessages(void);
+#endif
+    void CheckRequests(void);
+    void CompleteRequest(byte index, byte result, byte* data, int length);
+    byte ConfigureXBee(long baudrate, boolean master, boolean differential);
+#ifdef XBEE_USE_LINK_MONITOR
+    byte FindLink(byte* address, byte address_length);
+#endif
+#ifdef XBEE_USE_NODE_QUEUE
+    byte FindDestination(ByteArray* message);
+    byte FindNode(byte* address, byte address_length);
+#endif
+    byte FinishJob(byte result);
+#ifdef XBEE_USE_TX_QUEUE
+    void FlushQueue(void);
+    static byte FramePriority(byte* frame, int length);
+#endif
+#ifdef XBEE_USE_FRAGMENTS
+    void HandleFragment(byte* address, byte address_length, byte* payload, int length);
+#endif
+    void HandleFrame(byte* frame, int length);
+    void HandleScan(byte* frame, int length);
+    static int HexDigit(char c);
+#ifdef XBEE_USE_PACING
+    static boolean HasResponse(byte* frame, int length);
+    boolean IsReadyToSend(byte* frame, int length);
+#endif
+#ifdef XBEE_USE_TX_QUEUE
+    boolean IsQueued(byte priority);
+    boolean IsWritable(byte* frame, int length);
+#endif
+#ifdef XBEE_USE_LINK_MONITOR
+    unsigned long LinkTimeout(byte* address, byte address_length);
+#endif
+    byte NextConfigureStep(byte step);
+    byte NextFrameID(void);
+    byte NextJobStep(void);
+#ifdef XBEE_USE_TX_QUEUE
+    byte NextQueued(void);
+#endif
+    boolean ParseByte(byte b);
+    unsigned int ParseFrames(void);
+#ifdef XBEE_USE_PACING
+    void ReleaseFrame(byte api_identifier, byte frame_id);
+#endif
+    boolean ProbeCommandMode(void);
+#ifdef XBEE_USE_TX_QUEUE
+    boolean QueueFrame(byte* frame, int length, byte priority);
+#endif
+    void Reopen(long baudrate);
+#ifdef XBEE_USE_RETRIES
+    void ResendRequest(byte index);
+    static byte RetryClass(byte type);
+    unsigned long RetryDelay(byte request_class, byte attempt);
+    boolean RetryRequest(byte index, byte result, unsigned long rtt);
+#endif
+#ifdef XBEE_USE_FRAGMENTS
+    void SendFragment(byte* address, byte address_length, byte kind, byte message_id, byte index, byte count, byte* data, int length);
+#endif
+    void SendFrame(byte* frame, int length);
+#ifdef XBEE_USE_NODE_QUEUE
+    void SendHeld(void);
+#endif
+    boolean SendOwnFrame(ByteArray* message);
+#ifdef XBEE_USE_TX_QUEUE
+    void SendQueue(void);
+    void SendQueued(byte index);
+#endif
+    byte SendRequest(byte index, ByteArray* message);
+#ifdef XBEE_USE_LINK_MONITOR
+    void UpdateLink(byte* address, byte address_length, byte result, unsigned long rtt);
+#endif
+#ifdef XBEE_USE_NODE_QUEUE
+    void WakeNode(byte* address, byte address_length);
+#endif
+    void WriteFrame(byte* frame, int length);
+    void SendJobCommand(void);
+    void Setup(void);
+    void StampRequest(byte* frame, int length);
+    byte StartConfigureXBee(long baudrate, boolean master, boolean differential);
+#ifdef XBEE_API_STATS
+    static byte StatsBucket(unsigned long rtt);
+    static byte StatsIndex(byte api_identifier);
+#endif
+    byte StartJob(byte job);
+#ifdef XBEE_USE_PACING
+    void WaitToSend(byte* frame, int length);
+#endif
+  
+  friend class XBeeFrame; //to parse the HEX strings (see XBeeFrame::AppendHex())
+};
+
+
+
+
+#ifdef XBEE_USE_FRAME_POOL
+
+// Pool of fixed size frames (allocation and release in constant time)
+class XBeeFramePool{
+  
+  public:
+    static byte* Allocate(void);
+    static byte GetHighWaterMark(void);
+    static byte GetInUse(void);
+    static void Release(byte* ptr);
+  
+  private:
+    static byte _slots[XBEE_POOL_SLOTS][XBEE_POOL_SLOT_SIZE];
+    static byte _free[XBEE_POOL_SLOTS]; //stack of the released slots
+    static byte _num_free;
+    static byte _num_used; //slots used at least once
+};
+
+#endif // XBEE_USE_FRAME_POOL
+
+
+
+
+// Storage of the profiles of the XBee (see XBeeMaster::GetProfile())
+class XBeeProfile{
+  
+  public:
+    static boolean Check(ByteArray* profile);
+    static boolean Load(Stream* input, ByteArray* profile);
+#if defined(__AVR__)
+    static boolean Load(int eeprom_address, ByteArray* profile);
+#endif
+    static boolean Save(Print* output, ByteArray* profile);
+#if defined(__AVR__)
+    static boolean Save(int eeprom_address, ByteArray* profile);
+#endif
+  
+  private:
+    static int Read(Stream* input);
+  
+  friend class XBeeMaster; //to read the captures with the same timeout (see XBeeMaster::Replay())
 };
 
 
 
 
+#ifdef XBEE_API_DEBUG
+
+// Trace of the events in RAM (to be written when the time isn't critical)
+class XBeeTrace{
+  
+  public:
+    static void Clear(void);
+    static byte Dump(Print* output);
+    static void Record(byte event, byte arg0, byte arg1, byte arg2);
+  
+  private:
+    static XBeeTraceRecord _records[XBEE_TRACE_SIZE]; //ring buffer
+    static byte _first;
+    static byte _count;
+    static byte _lost;
+};
+
+#endif // XBEE_API_DEBUG
+
+
+
+
 class XBeeMessages{
   
   public:
-    static boolean CreateRemoteATRequest(ByteArray* barray_ptr, char* destination_address_64bit, char* destination_address_16bit, byte transmission_type, char* command_name, char* command_values);
+    static boolean CreateRemoteATRequest(ByteArray* barray_ptr, char* destination_address_64bit, char* destination_address_16bit, byte transmission_type, char* command_name, char* command_values, byte options = XBEE_REMOTE_APPLY);
+    static boolean CreateRemoteATRequest(XBeeFrame* frame, char* destination_address_64bit, char* destination_address_16bit, byte transmission_type, char* command_name, char* command_values, byte options = XBEE_REMOTE_APPLY);
+    static boolean DecodeATResponse(ByteArray* barray, XBeeATResponse* response);
+    static boolean DecodeATResponse(XBeeFrame* frame, XBeeATResponse* response);
+    static boolean DecodeATResponse(byte* frame, int length, XBeeATResponse* response);
+    static boolean DecodeInteger(byte* value, int length, unsigned long* number);
+    static boolean DecodeIOSample(byte* value, int length, XBeeIOSample* sample);
+    static boolean DecodeNodeRecord(byte* value, int length, XBeeNodeRecord* record);
+    static byte ResponseResult(byte api_identifier, byte status);
     static byte ResponseStatus(byte sent_message_type, char* response);
     static byte ResponseStatus(byte sent_message_type, ByteArray* barray);
+    static byte ResponseStatus(byte sent_message_type, XBeeFrame* frame);
 
 };
 
@@ -0,0 +1,90 @@
+#!/usr/bin/env python
+"""
+	RoboCore XBee API Library - Capture Decoder
+
+  Lists the frames recorded by XBeeMaster::SetCapture() (XBEE_API_CAPTURE defined)
+
+  Usage:
+    python xbee_capture_decode.py capture.bin
+    python xbee_capture_decode.py < capture.bin
+
+  Format of each record:
+    0xCA, port ID (bit 7 set for received frames), time in microseconds
+    (4 bytes, LSB first), length (2 bytes, LSB first), bytes of the frame
+
+  Copyright 2013 RoboCore ( http://www.RoboCore.net )
+  (GNU Lesser General Public License, see License.html)
+"""
+
+import struct
+import sys
+
+RECORD = 0xCA
+HEADER_SIZE = 8
+
+API_NAMES = {
+    0x00: "TX 64-bit",
+    0x01: "TX 16-bit",
+    0x08: "AT Command",
+    0x09: "AT Command Queue",
+    0x17: "Remote AT Request",
+    0x80: "RX 64-bit",
+    0x81: "RX 16-bit",
+    0x82: "RX 64-bit IO",
+    0x83: "RX 16-bit IO",
+    0x88: "AT Response",
+    0x89: "TX Status",
+    0x8A: "Modem Status",
+    0x97: "Remote AT Response",
+}
+
+
+def check(frame):
+    if len(frame) < 5 or frame[0] != 0x7E:
+        return "invalid"
+    length = (frame[1] << 8) | frame[2]
+    if length + 4 != len(frame):
+        return "invalid length"
+    if (sum(frame[3:]) & 0xFF) != 0xFF:
+        return "invalid checksum"
+    return ""
+
+
+def records(data):
+    position = 0
+    while position + HEADER_SIZE <= len(data):
+        if bytearray(data[position:position + 1])[0] != RECORD:
+            position += 1
+            continue
+        port, time, length = struct.unpack("<BIH", data[position + 1:position + HEADER_SIZE])
+        begin = position + HEADER_SIZE
+        frame = bytearray(data[begin:begin + length])
+        if len(frame) < length:
+            break
+        yield port, time, frame
+        position = begin + length
+
+
+def main():
+    if len(sys.argv) > 1:
+        with open(sys.argv[1], "rb") as f:
+            data = f.read()
+    else:
+        data = getattr(sys.stdin, "buffer", sys.stdin).read()
+
+    previous = None
+    for port, time, frame in records(data):
+        direction = "RX" if port & 0x80 else "TX"
+        delta = "" if previous is None else " (+%d)" % ((time - previous) & 0xFFFFFFFF)
+        previous = time
+        api = frame[3] if len(frame) > 3 else None
+        name = API_NAMES.get(api, "API 0x%02X" % api if api is not None else "-")
+        error = check(frame)
+        sys.stdout.write("%10d%s\tport %d %s\t%s\t%s%s\n" % (
+            time, delta, port & 0x7F, direction, name,
+            " ".join("%02X" % b for b in frame),
+            ("\t# " + error) if error else ""))
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,103 @@
+#!/usr/bin/env python
+"""
+	RoboCore XBee API Library - Trace Decoder
+
+  Decodes the trace written by XBeeTrace::Dump() (XBEE_API_DEBUG defined)
+
+  Usage:
+    python xbee_trace_decode.py capture.bin
+    python xbee_trace_decode.py < capture.bin
+
+  The input can contain other data (e.g. text printed by the sketch), only
+  the blocks that begin with 'XBT' are decoded.
+
+  Format of each block:
+    'XBT', number of records (1 byte), number of lost records (1 byte),
+    then 8 bytes per record: time in microseconds (4 bytes, LSB first),
+    event (1 byte), 3 arguments
+
+  Copyright 2013 RoboCore ( http://www.RoboCore.net )
+  (GNU Lesser General Public License, see License.html)
+"""
+
+import struct
+import sys
+
+# same values as XBEE_TRACE_* in XBee_API.h
+EVENTS = {
+    1: "AT_COMMAND",
+    2: "AT_REPLY",
+    3: "JOB_END",
+    4: "FRAME_TX",
+    5: "FRAME_RX",
+    6: "CHECKSUM_ERROR",
+    7: "REQUEST_END",
+    8: "INVALID_TYPE",
+    9: "REQUEST_RETRY",
+}
+
+RECORD_SIZE = 8
+
+
+def char(value):
+    if 0x20 <= value < 0x7F:
+        return chr(value)
+    return "\\x%02X" % value
+
+
+def describe(event, args):
+    a0, a1, a2 = args
+    if event == 1:
+        return "AT%s%s try %d" % (char(a0), char(a1), a2) if a0 != ord("+") else "+++ try %d" % a2
+    if event == 2:
+        return "%d chars '%s%s'" % (a0, char(a1), char(a2))
+    if event == 3:
+        return "job %d result %d" % (a0, a1)
+    if event in (4, 5):
+        return "API 0x%02X frame ID %d length %d" % (a0, a1, a2)
+    if event == 6:
+        return "API 0x%02X length %d" % (a0, a2)
+    if event == 7:
+        return "handle %d result %d type 0x%02X" % (a0, a1, a2)
+    if event == 8:
+        return "message type 0x%02X" % a0
+    if event == 9:
+        return "handle %d result %d attempt %d" % (a0, a1, a2)
+    return "%02X %02X %02X" % (a0, a1, a2)
+
+
+def decode(data, output):
+    position = data.find(b"XBT")
+    previous = None
+    while position >= 0 and position + 5 <= len(data):
+        count = bytearray(data[position + 3:position + 5])
+        lost = count[1]
+        count = count[0]
+        begin = position + 5
+        end = begin + count * RECORD_SIZE
+        if end > len(data):
+            output.write("# incomplete block\n")
+            break
+        if lost:
+            output.write("# %d records lost\n" % lost)
+        for i in range(count):
+            record = data[begin + i * RECORD_SIZE:begin + (i + 1) * RECORD_SIZE]
+            time, event = struct.unpack("<IB", record[:5])
+            args = bytearray(record[5:8])
+            delta = "" if previous is None else " (+%d)" % ((time - previous) & 0xFFFFFFFF)
+            previous = time
+            output.write("%10d%s\t%s\t%s\n" % (time, delta, EVENTS.get(event, "EVENT_%d" % event), describe(event, args)))
+        position = data.find(b"XBT", end)
+
+
+def main():
+    if len(sys.argv) > 1:
+        with open(sys.argv[1], "rb") as f:
+            data = f.read()
+    else:
+        data = getattr(sys.stdin, "buffer", sys.stdin).read()
+    decode(data, sys.stdout)
+
+
+if __name__ == "__main__":
+    main()